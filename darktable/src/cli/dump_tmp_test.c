@@ -0,0 +1,65 @@
+/*
+    This file is part of darktable,
+    Copyright (C) 2022 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// dump-tmp-test: writes a synthetic buffer through dump_tmp(), so that the
+// tap writers can be tested without a raw, a pipe or dt_init().
+//
+//   dump-tmp-test <width> <height> <channels> <tap>...
+//
+// writes the same buffer once for every <tap>, configured by the environment
+// exactly as in a render (DT_TAP_DIR, DT_TAP_SELECT, DT_TAP_FORMAT,
+// DT_TMP_LAYOUT, ...). Sample c of pixel (x, y) is
+//   ((y * width + x) * channels + c) / (width * height * channels),
+// a ramp in [0, 1) that py/test_dump_tmp.py recomputes to check what
+// py/loadTMP.py reads back.
+
+#include "common/darktable.h"
+#include "develop/imageop.h"
+#include "iop/dump_tmp.h"
+
+#include <stdlib.h>
+
+int main(int argc, char *arg[])
+{
+  if(argc < 5)
+  {
+    fprintf(stderr, "usage: %s <width> <height> <channels> <tap>...\n", arg[0]);
+    return 1;
+  }
+  const int width = atoi(arg[1]);
+  const int height = atoi(arg[2]);
+  const int channels = atoi(arg[3]);
+  if(width <= 0 || height <= 0 || channels <= 0)
+  {
+    fprintf(stderr, "%s: width, height and channels must be positive\n", arg[0]);
+    return 1;
+  }
+
+  const size_t n = (size_t)width * height * channels;
+  float *buffer = dt_alloc_align_float(n);
+  if(!buffer) return 1;
+  for(size_t k = 0; k < n; k++) buffer[k] = (float)k / n;
+
+  const dt_iop_roi_t roi = { .x = 0, .y = 0, .width = width, .height = height, .scale = 1.0f };
+  for(int k = 4; k < argc; k++) dump_tmp(buffer, &roi, channels, arg[k]);
+  // With DT_TAP_ASYNC, the writer still holds copies.
+  dump_tmp_flush();
+
+  dt_free_align(buffer);
+  return 0;
+}
@@ -0,0 +1,17 @@
+# dump-tmp-test, see dump_tmp_test.c and py/test_dump_tmp.py.
+#
+# Included from src/cli/CMakeLists.txt (the Dockerfile appends the include)
+# and installed next to libdarktable_kernels, whose rpath it shares.
+add_executable(dump-tmp-test dump_tmp_test.c)
+
+set_target_properties(dump-tmp-test PROPERTIES LINKER_LANGUAGE C)
+
+target_link_libraries(dump-tmp-test lib_darktable)
+
+if(APPLE)
+  set_target_properties(dump-tmp-test PROPERTIES INSTALL_RPATH @loader_path)
+else(APPLE)
+  set_target_properties(dump-tmp-test PROPERTIES INSTALL_RPATH $ORIGIN)
+endif(APPLE)
+
+install(TARGETS dump-tmp-test DESTINATION ${CMAKE_INSTALL_LIBDIR}/darktable COMPONENT DTApplication)
@@ -0,0 +1,282 @@
+/*
+    This file is part of darktable,
+    Copyright (C) 2022 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// libdarktable_kernels: runs a single iop's process() on a caller's buffer.
+//
+// No raw file, XMP or pixelpipe run is involved. For every call the module is
+// instantiated, its params are committed to a fresh piece of a dummy export
+// pipe, and process() is called with an identity region of interest
+// covering the whole buffer. Blending, masks and OpenCL are not involved:
+// this is the module's kernel only.
+//
+// The dummy pipe has processed_maximum 1, the given CFA `filters` (0 for RGB
+// input), the default iop order and linear Rec2020 input, work and output
+// profiles. colorin and colorout set up their own input and output profiles
+// from their params.
+//
+// dt_kernels_process() can also pin the codepath (plain C or SSE2) and time
+// repeated process() calls on the same piece, which py/benchmark_kernels.py
+// uses to measure the modules in isolation.
+//
+// py/darktable_kernels.py wraps this with ctypes. Tap-outs (iop/dump_tmp.h)
+// still fire inside process(); dt_kernels_init() turns them off unless
+// DT_TAP_SELECT is already set.
+
+#include "common/colorspaces.h"
+#include "common/darktable.h"
+#include "common/iop_order.h"
+#include "common/iop_profile.h"
+#include "develop/develop.h"
+#include "develop/imageop.h"
+#include "develop/pixelpipe.h"
+
+#include <glib.h>
+#include <math.h>
+#include <string.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#define DT_KERNELS_EXPORT __attribute__((visibility("default")))
+
+// Codepaths for dt_kernels_process().
+typedef enum dt_kernels_codepath_t
+{
+  DT_KERNELS_CODEPATH_DEFAULT = 0, // whatever darktable picked for this CPU
+  DT_KERNELS_CODEPATH_PLAIN = 1,   // process()
+  DT_KERNELS_CODEPATH_SSE2 = 2     // process_sse2()
+} dt_kernels_codepath_t;
+
+// Initializes darktable without a GUI. argv is passed to dt_init() like
+// darktable-cli's core options; the caller should include
+// "--library :memory:". Returns 0 on success.
+DT_KERNELS_EXPORT int dt_kernels_init(int argc, char *argv[])
+{
+  g_setenv("DT_TAP_SELECT", "none", FALSE);
+  return dt_init(argc, argv, FALSE, FALSE, NULL);
+}
+
+// Sets the number of OpenMP threads the kernels use.
+DT_KERNELS_EXPORT void dt_kernels_set_threads(const int threads)
+{
+#ifdef _OPENMP
+  darktable.num_openmp_threads = threads;
+  omp_set_num_threads(threads);
+#endif
+}
+
+// The widest instruction set among __DT_CLONE_TARGETS__ that this CPU has,
+// i.e. which clone a cloned process() runs: "avx512f", "avx2", "avx", "sse2"
+// or "default".
+DT_KERNELS_EXPORT const char *dt_kernels_clone_target(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+  if(__builtin_cpu_supports("avx512f")) return "avx512f";
+  if(__builtin_cpu_supports("avx2")) return "avx2";
+  if(__builtin_cpu_supports("avx")) return "avx";
+  if(__builtin_cpu_supports("sse2")) return "sse2";
+#endif
+  return "default";
+}
+
+DT_KERNELS_EXPORT void dt_kernels_cleanup(void)
+{
+  dt_cleanup();
+}
+
+static dt_iop_module_so_t *find_module_so(const char *op)
+{
+  for(const GList *iop = darktable.iop; iop; iop = g_list_next(iop))
+  {
+    dt_iop_module_so_t *so = (dt_iop_module_so_t *)iop->data;
+    if(!strcmp(so->op, op)) return so;
+  }
+  return NULL;
+}
+
+// Returns the size of `op`'s params struct, or -1 if there is no such iop.
+DT_KERNELS_EXPORT int dt_kernels_params_size(const char *op)
+{
+  dt_iop_module_so_t *so = find_module_so(op);
+  if(!so) return -1;
+
+  dt_develop_t dev;
+  dt_dev_init(&dev, 0);
+  dt_iop_module_t module;
+  int size = -1;
+  if(!dt_iop_load_module(&module, so, &dev))
+  {
+    size = module.params_size;
+    dt_iop_cleanup_module(&module);
+  }
+  dt_dev_cleanup(&dev);
+  return size;
+}
+
+// Runs `op`'s process() from `in` to `out`, both width x height x channels
+// floats. `params` must be params_size bytes of the module's params struct,
+// or NULL for its defaults. `filters` is the CFA pattern of single-channel
+// raw input (e.g. 0x94949494 for RGGB), or 0. process() runs `repeat` times
+// with the given codepath; if `seconds` is not NULL it receives the wall time
+// of one call, averaged. Returns 0 on success, otherwise writes a message to
+// `error`; a process() that writes no output at all is an error too. `in` and
+// `out` need no particular alignment: they are copied through aligned
+// buffers, outside the timed calls.
+DT_KERNELS_EXPORT int dt_kernels_process(const char *op, const void *params, const size_t params_size,
+                                         const float *in, float *out, const int width, const int height,
+                                         const int channels, const uint32_t filters,
+                                         const dt_kernels_codepath_t codepath, const int repeat, double *seconds,
+                                         char *error, const size_t error_size)
+{
+  dt_iop_module_so_t *so = find_module_so(op);
+  if(!so)
+  {
+    g_strlcpy(error, "no such iop", error_size);
+    return 1;
+  }
+
+  dt_develop_t dev;
+  dt_dev_init(&dev, 0);
+  dev.image_storage.width = dev.image_storage.p_width = width;
+  dev.image_storage.height = dev.image_storage.p_height = height;
+  dev.image_storage.buf_dsc.channels = channels;
+  dev.image_storage.buf_dsc.datatype = TYPE_FLOAT;
+  dev.image_storage.buf_dsc.filters = filters;
+  dev.image_storage.flags |= filters ? DT_IMAGE_RAW : 0;
+  // The default (v3.0) order, as for a new image: modules look up whether they
+  // run before colorin, between colorin and colorout, or after colorout to
+  // pick the profile of their input, see dt_ioppr_get_pipe_current_profile_info().
+  dev.iop_order_list = dt_ioppr_get_iop_order_list(0, FALSE);
+
+  dt_iop_module_t module;
+  if(dt_iop_load_module(&module, so, &dev))
+  {
+    dt_dev_cleanup(&dev);
+    g_strlcpy(error, "could not load iop", error_size);
+    return 1;
+  }
+  module.iop_order = dt_ioppr_get_iop_order(dev.iop_order_list, op, module.multi_priority);
+  if(params && params_size != module.params_size)
+  {
+    g_snprintf(error, error_size, "params are %zu bytes, %s expects %d", params_size, op, module.params_size);
+    dt_iop_cleanup_module(&module);
+    dt_dev_cleanup(&dev);
+    return 1;
+  }
+  __typeof__(module.process) process = module.process;
+  if(codepath == DT_KERNELS_CODEPATH_PLAIN) process = module.process_plain;
+#if defined(__SSE2__)
+  if(codepath == DT_KERNELS_CODEPATH_SSE2) process = module.process_sse2;
+#else
+  if(codepath == DT_KERNELS_CODEPATH_SSE2) process = NULL;
+#endif
+  if(!process)
+  {
+    g_snprintf(error, error_size, "%s has no such codepath", op);
+    dt_iop_cleanup_module(&module);
+    dt_dev_cleanup(&dev);
+    return 1;
+  }
+  memcpy(module.params, params ? params : module.default_params, module.params_size);
+  module.enabled = TRUE;
+
+  dt_dev_pixelpipe_t pipe;
+  dt_dev_pixelpipe_init_dummy(&pipe, width, height);
+  pipe.type = DT_DEV_PIXELPIPE_EXPORT;
+  pipe.image = dev.image_storage;
+  pipe.iwidth = pipe.processed_width = width;
+  pipe.iheight = pipe.processed_height = height;
+  pipe.iscale = 1.0f;
+  pipe.dsc = dev.image_storage.buf_dsc;
+  for(int c = 0; c < 4; c++) pipe.dsc.processed_maximum[c] = 1.0f;
+  // Every profile is linear Rec2020, so that no module finds its profile
+  // missing; colorin and colorout replace theirs in commit_params().
+  const dt_colormatrix_t identity = { { 1.0f, 0.0f, 0.0f, 0.0f },
+                                      { 0.0f, 1.0f, 0.0f, 0.0f },
+                                      { 0.0f, 0.0f, 1.0f, 0.0f } };
+  dt_ioppr_set_pipe_input_profile_info(&dev, &pipe, DT_COLORSPACE_LIN_REC2020, "", DT_INTENT_PERCEPTUAL, identity);
+  dt_ioppr_set_pipe_work_profile_info(&dev, &pipe, DT_COLORSPACE_LIN_REC2020, "", DT_INTENT_PERCEPTUAL);
+  dt_ioppr_set_pipe_output_profile_info(&dev, &pipe, DT_COLORSPACE_LIN_REC2020, "", DT_INTENT_PERCEPTUAL);
+
+  dt_dev_pixelpipe_iop_t piece = { 0 };
+  piece.module = &module;
+  piece.pipe = &pipe;
+  piece.enabled = TRUE;
+  piece.colors = channels;
+  piece.iwidth = width;
+  piece.iheight = height;
+  piece.iscale = 1.0f;
+  piece.dsc_in = piece.dsc_out = pipe.dsc;
+  const dt_iop_roi_t roi = { .x = 0, .y = 0, .width = width, .height = height, .scale = 1.0f };
+  piece.buf_in = piece.buf_out = piece.processed_roi_in = piece.processed_roi_out = roi;
+
+  // The modules rely on 64-byte aligned buffers, as dt_alloc_align() hands
+  // out to the pipe, but the caller's (e.g. numpy's) are only 16-byte aligned.
+  const size_t size = sizeof(float) * width * height * channels;
+  float *const aligned_in = dt_alloc_align(64, size);
+  float *const aligned_out = dt_alloc_align(64, size);
+  if(!aligned_in || !aligned_out)
+  {
+    g_strlcpy(error, "out of memory", error_size);
+    dt_free_align(aligned_in);
+    dt_free_align(aligned_out);
+    dt_dev_pixelpipe_cleanup(&pipe);
+    dt_iop_cleanup_module(&module);
+    dt_dev_cleanup(&dev);
+    return 1;
+  }
+  memcpy(aligned_in, in, size);
+  // NaN marks what process() didn't write: some modules return early, e.g.
+  // without the profiles they need.
+  const size_t nfloats = (size_t)width * height * channels;
+  for(size_t k = 0; k < nfloats; k++) aligned_out[k] = NAN;
+
+  module.init_pipe(&module, &pipe, &piece);
+  module.commit_params(&module, module.params, &pipe, &piece);
+  // exposure, temperature and highlights update pipe.dsc (processed_maximum)
+  // as they run, so every call starts from the same descriptor.
+  const dt_iop_buffer_dsc_t dsc = pipe.dsc;
+  const double start = dt_get_wtime();
+  for(int k = 0; k < MAX(repeat, 1); k++)
+  {
+    pipe.dsc = dsc;
+    process(&module, &piece, aligned_in, aligned_out, &roi, &roi);
+  }
+  if(seconds) *seconds = (dt_get_wtime() - start) / MAX(repeat, 1);
+  module.cleanup_pipe(&module, &pipe, &piece);
+
+  gboolean written = FALSE;
+  for(size_t k = 0; k < nfloats && !written; k++) written = !isnan(aligned_out[k]);
+  if(written)
+    memcpy(out, aligned_out, size);
+  else
+    g_snprintf(error, error_size, "%s's process() wrote no output", op);
+  dt_free_align(aligned_in);
+  dt_free_align(aligned_out);
+
+  dt_dev_pixelpipe_cleanup(&pipe);
+  dt_iop_cleanup_module(&module);
+  dt_dev_cleanup(&dev);
+  return written ? 0 : 1;
+}
+
+// clang-format off
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.py
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
+// clang-format on
@@ -0,0 +1,15 @@
+# libdarktable_kernels, see kernels.c.
+#
+# Included from src/cli/CMakeLists.txt (the Dockerfile appends the include)
+# and installed next to libdarktable, whose rpath it shares.
+add_library(darktable_kernels SHARED kernels.c)
+
+target_link_libraries(darktable_kernels lib_darktable)
+
+if(APPLE)
+  set_target_properties(darktable_kernels PROPERTIES INSTALL_RPATH @loader_path)
+else(APPLE)
+  set_target_properties(darktable_kernels PROPERTIES INSTALL_RPATH $ORIGIN)
+endif(APPLE)
+
+install(TARGETS darktable_kernels DESTINATION ${CMAKE_INSTALL_LIBDIR}/darktable COMPONENT DTApplication)
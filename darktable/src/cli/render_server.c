@@ -0,0 +1,709 @@
+/*
+    This file is part of darktable,
+    Copyright (C) 2022 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// darktable-render-server: a long-lived, headless darktable-cli.
+//
+// darktable-cli pays for dt_init() (library, plugins, OpenCL probing, LUTs) on
+// every invocation, which dominates small renders. This binary initializes
+// once and then reads render requests from stdin, one per line, with
+// tab-separated fields:
+//
+//   render <input> <xmp> <output>   render <input> with the history in <xmp>;
+//                                   an <output> of shm:<name> leaves the float
+//                                   result in shared memory, see
+//                                   export_held_shm()
+//   env <NAME> <VALUE>              setenv(), e.g. DT_TAP_PREFIX; an empty
+//                                   VALUE unsets NAME
+//   hold <input>                    decode <input> and keep it decoded until
+//                                   `release`, for batches of renders
+//   release <input>
+//   quit                            exit (so does EOF)
+//
+// Every request is answered with exactly one line on stdout:
+//
+//   [render_server] ok <output> <seconds>
+//   [render_server] error <output or request> <message>
+//
+// darktable itself prints to stdout too (e.g. with -d perf), so clients must
+// skip lines without the "[render_server] " prefix. Arguments after --core
+// are passed to darktable as with darktable-cli.
+//
+// Renders of a held input go through a pixelpipe that lives as long as the
+// hold. darktable's pixelpipe cache keys every module's output by the image
+// id, the region of interest and the params hashes of that module and all
+// modules before it, so when a batch only changes, say, colorbalancergb, the
+// next render picks up the cached output of the module before it and only runs
+// from colorbalancergb on. DT_PIPE_CACHE_ENTRIES (default 3, read at `hold`)
+// sets how many module outputs are kept. Cache lines are allocated on first
+// use at the size of the output they hold, so memory grows with the lines
+// actually used, up to that many times 16 bytes per pixel of the ROI. The
+// cache keeps the most recent outputs, so reusing the input of a module needs
+// as many entries as there are enabled modules from that module to the end of
+// the pipe, e.g. 4 for a colorbalancergb sweep with 8-bit output
+// (sharpen, colorbalancergb, colorout, gamma). The cache is in memory only:
+// cache lines are darktable's own pixelpipe buffers and don't outlive the
+// hold. Modules served from the cache
+// don't run and would miss their taps, so when DT_TAP_SELECT selects a tap of
+// any module upstream of the first changed one, the cache is flushed and the
+// whole pipe runs again. With DT_TAP_SELECT unset every tap is selected, so
+// there is no reuse; select only the swept module's taps, e.g.
+// DT_TAP_SELECT=colorbalancergb, or none, to keep it.
+//
+// Tap-outs (iop/dump_tmp.h) read their configuration from the environment at
+// every tap, so `env` requests take effect on the next render. The exception
+// is DT_TAP_ASYNC, which is read once per process; queued taps are flushed
+// before a render is reported done.
+//
+// With DT_TAP_TRACE set, the tapped modules append their process(), OpenMP
+// region and tap timings to that file as JSON lines (see iop/dump_tmp.h), and
+// every render request adds a closing
+//   {"cat":"render","name":"<output>","input":"<input>","ok":true,...}
+// line with the render's total wall and CPU time, written after its taps are
+// flushed. The events of one render are the lines with the same "pid" since
+// that process's previous render line.
+
+#include "common/colorspaces.h"
+#include "common/darktable.h"
+#include "common/exif.h"
+#include "common/film.h"
+#include "common/history.h"
+#include "common/image.h"
+#include "common/image_cache.h"
+#include "common/imageio.h"
+#include "common/imageio_module.h"
+#include "common/metadata_export.h"
+#include "common/mipmap_cache.h"
+#include "control/conf.h"
+#include "develop/develop.h"
+#include "develop/imageop.h"
+#include "develop/pixelpipe.h"
+#include "iop/dump_tmp_select.h"
+
+#include <fcntl.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <gmodule.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#define RS_PREFIX "[render_server] "
+
+#define RS_DEFAULT_CACHE_ENTRIES 3
+// The fewest lines a pixelpipe cache works with; what darktable-cli's
+// dt_dev_pixelpipe_init_export() uses for one-off renders.
+#define RS_MIN_CACHE_ENTRIES 2
+
+// `render` outputs starting with this go to shared memory, see
+// export_held_shm().
+#define RS_SHM_PREFIX "shm:"
+// DT_TMP_TYPE_FLOAT32 | DT_TMP_FLAG_INTERLEAVED from iop/dump_tmp.h.
+#define RS_TMP_TYPE_INTERLEAVED_FLOAT32 (0 | (1 << 16))
+
+// An input kept decoded by `hold`: the read lock on its full-size mipmap pins
+// the decoded raw in the mipmap cache, so every render of the batch reuses it.
+// `pipe` is created on the first render and keeps its cache between renders;
+// its nodes are rebuilt for every render's history. `hashes` holds the params
+// hash of every node of the previous render, see upstream_tapped().
+typedef struct rs_held_t
+{
+  int32_t imgid;
+  dt_mipmap_buffer_t full;
+  int cache_entries;
+  gboolean pipe_initialized;
+  dt_dev_pixelpipe_t pipe;
+  GArray *hashes;
+} rs_held_t;
+
+// Input path -> rs_held_t.
+static GHashTable *held = NULL;
+
+static void reply_ok(const char *output, const double seconds)
+{
+  printf(RS_PREFIX "ok\t%s\t%.3f\n", output, seconds);
+  fflush(stdout);
+}
+
+static void reply_error(const char *request, const char *message)
+{
+  printf(RS_PREFIX "error\t%s\t%s\n", request, message);
+  fflush(stdout);
+}
+
+// Waits for the asynchronous tap writers of every loaded iop, see
+// dump_tmp_flush() in iop/dump_tmp.h.
+static void flush_taps(void)
+{
+  for(const GList *iop = darktable.iop; iop; iop = g_list_next(iop))
+  {
+    dt_iop_module_so_t *so = (dt_iop_module_so_t *)iop->data;
+    void (*flush)(void) = NULL;
+    if(so->module && g_module_symbol(so->module, "dump_tmp_flush", (gpointer *)&flush) && flush) flush();
+  }
+}
+
+// CPU time of the whole process so far, in microseconds.
+static gint64 cpu_time_us(void)
+{
+  struct timespec ts;
+  if(clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts)) return 0;
+  return (gint64)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+// Quotes s as a JSON string.
+static void json_append_string(GString *json, const char *s)
+{
+  g_string_append_c(json, '"');
+  for(const unsigned char *c = (const unsigned char *)s; *c; c++)
+  {
+    if(*c == '"' || *c == '\\')
+      g_string_append_printf(json, "\\%c", *c);
+    else if(*c < 0x20)
+      g_string_append_printf(json, "\\u%04x", *c);
+    else
+      g_string_append_c(json, *c);
+  }
+  g_string_append_c(json, '"');
+}
+
+// Appends the render event to $DT_TAP_TRACE, if set.
+static void trace_render(const char *input, const char *output, const gboolean ok, const gint64 wall_start,
+                         const gint64 cpu_start)
+{
+  const char *trace = g_getenv("DT_TAP_TRACE");
+  if(!trace || !*trace) return;
+
+  GString *line = g_string_new("{\"cat\":\"render\",\"name\":");
+  json_append_string(line, output);
+  g_string_append(line, ",\"input\":");
+  json_append_string(line, input);
+  g_string_append_printf(line,
+                         ",\"ok\":%s,\"pid\":%d,\"ts_us\":%" G_GINT64_FORMAT ",\"wall_us\":%" G_GINT64_FORMAT
+                         ",\"process_cpu_us\":%" G_GINT64_FORMAT ",\"threads\":%d}\n",
+                         ok ? "true" : "false", (int)getpid(), wall_start, g_get_monotonic_time() - wall_start,
+                         cpu_time_us() - cpu_start, dt_get_num_threads());
+  FILE *f = g_fopen(trace, "a");
+  if(f)
+  {
+    fputs(line->str, f);
+    fclose(f);
+  }
+  else
+    fprintf(stderr, "[render_server] could not open trace %s\n", trace);
+  g_string_free(line, TRUE);
+}
+
+// Returns the library id of `input`, importing it on first use.
+static int32_t import_image(const char *input)
+{
+  const rs_held_t *h = g_hash_table_lookup(held, input);
+  if(h) return h->imgid;
+
+  gchar *directory = g_path_get_dirname(input);
+  dt_film_t film;
+  const int32_t filmid = dt_film_new(&film, directory);
+  g_free(directory);
+  if(filmid <= 0) return 0;
+  return dt_image_import(filmid, input, TRUE, FALSE);
+}
+
+// Decodes `input` and pins it, see rs_held_t. Its pipe keeps `cache_entries`
+// module outputs between renders; 0 reads DT_PIPE_CACHE_ENTRIES. Returns NULL
+// and sets `error` on failure.
+static rs_held_t *hold_image(const char *input, const int cache_entries, const char **error)
+{
+  if(!g_file_test(input, G_FILE_TEST_IS_REGULAR))
+  {
+    *error = "input not found";
+    return NULL;
+  }
+  const int32_t imgid = import_image(input);
+  if(imgid <= 0)
+  {
+    *error = "import failed";
+    return NULL;
+  }
+
+  rs_held_t *h = g_new0(rs_held_t, 1);
+  h->imgid = imgid;
+  h->cache_entries = cache_entries;
+  if(!h->cache_entries)
+  {
+    const char *entries = g_getenv("DT_PIPE_CACHE_ENTRIES");
+    h->cache_entries = entries ? MAX(RS_MIN_CACHE_ENTRIES, atoi(entries)) : RS_DEFAULT_CACHE_ENTRIES;
+  }
+  h->hashes = g_array_new(FALSE, FALSE, sizeof(uint64_t));
+  dt_mipmap_cache_get(darktable.mipmap_cache, &h->full, imgid, DT_MIPMAP_FULL, DT_MIPMAP_BLOCKING, 'r');
+  if(!h->full.buf)
+  {
+    dt_mipmap_cache_release(darktable.mipmap_cache, &h->full);
+    g_array_free(h->hashes, TRUE);
+    g_free(h);
+    *error = "decode failed";
+    return NULL;
+  }
+  return h;
+}
+
+static void release_held(gpointer data)
+{
+  rs_held_t *h = (rs_held_t *)data;
+  if(h->pipe_initialized) dt_dev_pixelpipe_cleanup(&h->pipe);
+  dt_mipmap_cache_release(darktable.mipmap_cache, &h->full);
+  g_array_free(h->hashes, TRUE);
+  g_free(h);
+}
+
+// Replaces the history of `imgid` with the one in `xmp`.
+static gboolean apply_xmp(const int32_t imgid, const char *xmp)
+{
+  dt_history_delete_on_image(imgid);
+  dt_image_t *image = dt_image_cache_get(darktable.image_cache, imgid, 'w');
+  const int failed = dt_exif_xmp_read(image, xmp, 1);
+  // Don't write a sidecar back.
+  dt_image_cache_write_release(darktable.image_cache, image, DT_IMAGE_CACHE_RELAXED);
+  return !failed;
+}
+
+static const char *format_name(const char *ext)
+{
+  if(!g_ascii_strcasecmp(ext, "jpg")) return "jpeg";
+  if(!g_ascii_strcasecmp(ext, "tif")) return "tiff";
+  return ext;
+}
+
+// Returns the format matching the extension of `output`, or NULL.
+static dt_imageio_module_format_t *output_format(const char *output)
+{
+  const char *dot = strrchr(output, '.');
+  if(!dot || strchr(dot, G_DIR_SEPARATOR)) return NULL;
+
+  gchar *ext = g_ascii_strdown(dot + 1, -1);
+  dt_imageio_module_format_t *format = dt_imageio_get_format_by_name(format_name(ext));
+  g_free(ext);
+  return format;
+}
+
+// Exports `imgid` to `output` like darktable-cli does: the disk storage
+// appends the extension of the chosen format to the path without its own.
+static gboolean export_image(const int32_t imgid, const char *output)
+{
+  dt_imageio_module_format_t *format = output_format(output);
+  dt_imageio_module_storage_t *storage = dt_imageio_get_storage_by_name("disk");
+  if(!format || !storage) return FALSE;
+
+  // Re-rendering a path replaces it instead of making up a new name.
+  dt_conf_set_int("plugins/imageio/storage/disk/overwrite", 1);
+  dt_imageio_module_data_t *sdata = storage->get_params(storage);
+  dt_imageio_module_data_t *fdata = format->get_params(format);
+  if(!sdata || !fdata)
+  {
+    if(sdata) storage->free_params(storage, sdata);
+    if(fdata) format->free_params(format, fdata);
+    return FALSE;
+  }
+
+  gchar *path = g_strndup(output, strrchr(output, '.') - output);
+  g_strlcpy((char *)sdata, path, DT_MAX_PATH_FOR_PARAMS);
+  g_free(path);
+  fdata->style[0] = '\0';
+  fdata->max_width = 0;
+  fdata->max_height = 0;
+
+  dt_export_metadata_t metadata;
+  metadata.flags = dt_lib_export_metadata_default_flags();
+  metadata.list = NULL;
+
+  const int failed = storage->store(storage, sdata, imgid, format, fdata, 1, 1, TRUE, FALSE, FALSE,
+                                    DT_COLORSPACE_NONE, NULL, DT_INTENT_LAST, &metadata);
+
+  format->free_params(format, fdata);
+  storage->free_params(storage, sdata);
+  return !failed;
+}
+
+// Converts the float RGBA output of the pipe to what `format` expects, as
+// dt_imageio_export_with_flags() does. The pipe's backbuf is a cache line that
+// later renders may reuse, so this works on a copy.
+static void *convert_output(const dt_dev_pixelpipe_t *pipe, const int bpp, const int width, const int height)
+{
+  const size_t npixels = (size_t)width * height;
+  if(bpp == 8)
+  {
+    // gamma already wrote 8-bit BGRA, swap it to RGBA.
+    uint8_t *const out = dt_alloc_align(64, npixels * 4);
+    if(!out) return NULL;
+    const uint8_t *const in = (const uint8_t *)pipe->backbuf;
+#ifdef _OPENMP
+#pragma omp parallel for default(none) dt_omp_firstprivate(in, out, npixels) schedule(static)
+#endif
+    for(size_t k = 0; k < npixels; k++)
+    {
+      out[4 * k + 0] = in[4 * k + 2];
+      out[4 * k + 1] = in[4 * k + 1];
+      out[4 * k + 2] = in[4 * k + 0];
+      out[4 * k + 3] = in[4 * k + 3];
+    }
+    return out;
+  }
+
+  float *const out = dt_alloc_align_float(npixels * 4);
+  if(!out) return NULL;
+  memcpy(out, pipe->backbuf, npixels * 4 * sizeof(float));
+  if(bpp == 16)
+  {
+    // In place: each uint16 sample is written at or before the float it came from.
+    uint16_t *const out16 = (uint16_t *)out;
+    for(size_t k = 0; k < npixels; k++)
+      for(int c = 0; c < 3; c++) out16[4 * k + c] = CLAMP(out[4 * k + c] * 0x10000, 0, 0xffff);
+  }
+  return out;
+}
+
+// The pipe cache serves every module upstream of the first one whose params
+// changed since the previous render: those modules don't run, so they don't
+// write their taps either. Returns whether one of them is tapped, and records
+// the node hashes of this render for the next one.
+static gboolean upstream_tapped(rs_held_t *h, const dt_dev_pixelpipe_t *pipe)
+{
+  const guint previous = h->hashes->len;
+  gboolean changed = FALSE, tapped = FALSE;
+  guint k = 0;
+  for(const GList *node = pipe->nodes; node; node = g_list_next(node), k++)
+  {
+    const dt_dev_pixelpipe_iop_t *piece = (dt_dev_pixelpipe_iop_t *)node->data;
+    changed = changed || k >= previous || g_array_index(h->hashes, uint64_t, k) != piece->hash;
+    if(!changed && piece->enabled && dump_tmp_module_selected(piece->module->op)) tapped = TRUE;
+    if(k < previous)
+      g_array_index(h->hashes, uint64_t, k) = piece->hash;
+    else
+      g_array_append_val(h->hashes, piece->hash);
+  }
+  g_array_set_size(h->hashes, k);
+  return tapped;
+}
+
+// Runs the current history of the held image through its persistent pipe.
+// On success the result is in h->pipe.backbuf, processed_width x
+// processed_height pixels; call finish_held() once it has been written.
+static gboolean process_held(rs_held_t *h, dt_develop_t *dev, const int levels, const gboolean gamma)
+{
+  dt_dev_init(dev, 0);
+  dt_dev_load_image(dev, h->imgid);
+
+  dt_dev_pixelpipe_t *pipe = &h->pipe;
+  if(!h->pipe_initialized)
+  {
+    // dt_dev_pixelpipe_init_export(), but with h->cache_entries lines. A size
+    // of 0 leaves every line unallocated until a module output is stored in
+    // it, and then sizes it from that output's ROI.
+    dt_dev_pixelpipe_init_cached(pipe, 0, h->cache_entries);
+    pipe->type = DT_DEV_PIXELPIPE_EXPORT;
+    pipe->levels = levels;
+    pipe->store_all_raster_masks = FALSE;
+    h->pipe_initialized = TRUE;
+  }
+  else if(pipe->levels != levels)
+  {
+    // The cache key doesn't cover the output depth.
+    dt_dev_pixelpipe_cache_flush(&pipe->cache);
+    pipe->levels = levels;
+  }
+
+  dt_dev_pixelpipe_set_icc(pipe, DT_COLORSPACE_NONE, NULL, DT_INTENT_LAST);
+  dt_dev_pixelpipe_set_input(pipe, dev, (float *)h->full.buf, h->full.width, h->full.height, h->full.iscale);
+  dt_dev_pixelpipe_create_nodes(pipe, dev);
+  pipe->shutdown = 0;
+  dt_dev_pixelpipe_synch_all(pipe, dev);
+  // Tapped modules must run in every render, e.g. for every variant's
+  // <prefix><stage>_in.tmp of a sweep, so a cache hit on one is a miss.
+  if(upstream_tapped(h, pipe)) dt_dev_pixelpipe_cache_flush(&pipe->cache);
+  dt_dev_pixelpipe_get_dimensions(pipe, dev, pipe->iwidth, pipe->iheight, &pipe->processed_width,
+                                  &pipe->processed_height);
+  const int width = pipe->processed_width;
+  const int height = pipe->processed_height;
+
+  return gamma ? !dt_dev_pixelpipe_process(pipe, dev, 0, 0, width, height, 1.0)
+               : !dt_dev_pixelpipe_process_no_gamma(pipe, dev, 0, 0, width, height, 1.0);
+}
+
+static void finish_held(rs_held_t *h, dt_develop_t *dev)
+{
+  // The nodes point into dev's modules, so they go with it; the cache stays.
+  dt_dev_pixelpipe_cleanup_nodes(&h->pipe);
+  dt_dev_cleanup(dev);
+}
+
+// Renders the held image through its persistent pipe and writes it to
+// `output`, with the same defaults as export_image().
+static gboolean export_held(rs_held_t *h, const char *input, const char *output)
+{
+  dt_imageio_module_format_t *format = output_format(output);
+  if(!format) return FALSE;
+  dt_imageio_module_data_t *fdata = format->get_params(format);
+  if(!fdata) return FALSE;
+  fdata->style[0] = '\0';
+  fdata->max_width = 0;
+  fdata->max_height = 0;
+
+  dt_develop_t dev;
+  const int bpp = format->bpp(fdata);
+  const dt_dev_pixelpipe_t *pipe = &h->pipe;
+  const gboolean processed = process_held(h, &dev, format->levels(fdata), bpp == 8);
+  const int width = pipe->processed_width;
+  const int height = pipe->processed_height;
+  void *outbuf = processed ? convert_output(pipe, bpp, width, height) : NULL;
+
+  gboolean ok = FALSE;
+  if(outbuf)
+  {
+    dt_colorspaces_color_profile_type_t icc_type = DT_COLORSPACE_NONE;
+    const dt_colorspaces_color_profile_t *profile = dt_colorspaces_get_output_profile(h->imgid, &icc_type, "");
+    const gboolean sRGB = profile && profile->type == DT_COLORSPACE_SRGB;
+    uint8_t *exif = NULL;
+    const int exif_len = dt_exif_read_blob(&exif, input, h->imgid, sRGB, width, height, 0);
+
+    gchar *path = g_strndup(output, strrchr(output, '.') - output);
+    gchar *filename = g_strdup_printf("%s.%s", path, format->extension(fdata));
+    fdata->width = width;
+    fdata->height = height;
+    ok = !format->write_image(fdata, filename, outbuf, DT_COLORSPACE_NONE, NULL, exif, exif_len, h->imgid, 1, 1,
+                              (dt_dev_pixelpipe_t *)pipe, FALSE);
+    g_free(filename);
+    g_free(path);
+    free(exif);
+    dt_free_align(outbuf);
+  }
+
+  finish_held(h, &dev);
+  format->free_params(format, fdata);
+  return ok;
+}
+
+// Renders the held image and leaves its float RGBA output in the POSIX shared
+// memory object /<name>, as a single-frame interleaved float32 TMP file (see
+// iop/dump_tmp.h). On Linux that is /dev/shm/<name>, which py/loadTMP.py maps
+// without a copy. The client unlinks it.
+static gboolean export_held_shm(rs_held_t *h, const char *name)
+{
+  dt_develop_t dev;
+  const dt_dev_pixelpipe_t *pipe = &h->pipe;
+  gboolean ok = process_held(h, &dev, IMAGEIO_RGB | IMAGEIO_FLOAT, FALSE);
+  if(ok)
+  {
+    const int32_t header[5] = { pipe->processed_width, pipe->processed_height, 1, 4, RS_TMP_TYPE_INTERLEAVED_FLOAT32 };
+    const size_t data_size = (size_t)pipe->processed_width * pipe->processed_height * 4 * sizeof(float);
+    const size_t size = sizeof(header) + data_size;
+
+    gchar *shm_name = g_strconcat("/", name, NULL);
+    const int fd = shm_open(shm_name, O_CREAT | O_RDWR | O_TRUNC, 0600);
+    ok = fd >= 0 && !ftruncate(fd, size);
+    void *map = ok ? mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) : MAP_FAILED;
+    if(map != MAP_FAILED)
+    {
+      memcpy(map, header, sizeof(header));
+      memcpy((uint8_t *)map + sizeof(header), pipe->backbuf, data_size);
+      munmap(map, size);
+    }
+    else
+      ok = FALSE;
+    if(fd >= 0)
+    {
+      close(fd);
+      // The client only maps (and unlinks) the object of a render reported ok.
+      if(!ok) shm_unlink(shm_name);
+    }
+    g_free(shm_name);
+  }
+  finish_held(h, &dev);
+  return ok;
+}
+
+static void handle_render(gchar **fields)
+{
+  const char *input = fields[1], *xmp = fields[2], *output = fields[3];
+  const double start = dt_get_wtime();
+  const gint64 trace_wall_start = g_get_monotonic_time();
+  const gint64 trace_cpu_start = cpu_time_us();
+
+  if(!g_file_test(input, G_FILE_TEST_IS_REGULAR))
+  {
+    reply_error(output, "input not found");
+    return;
+  }
+  if(!g_file_test(xmp, G_FILE_TEST_IS_REGULAR))
+  {
+    reply_error(output, "xmp not found");
+    return;
+  }
+
+  const int32_t imgid = import_image(input);
+  if(imgid <= 0)
+  {
+    reply_error(output, "import failed");
+    return;
+  }
+  if(!apply_xmp(imgid, xmp))
+  {
+    reply_error(output, "xmp could not be read");
+    return;
+  }
+
+  rs_held_t *h = g_hash_table_lookup(held, input);
+  gboolean ok;
+  if(g_str_has_prefix(output, RS_SHM_PREFIX))
+  {
+    // Shared memory output needs the pipe's buffer, so hold the input for
+    // this render if it isn't held already. Nothing outlives this render, so
+    // its pipe gets no more cache than a plain `render`.
+    const char *error = NULL;
+    rs_held_t *tmp = h ? NULL : hold_image(input, RS_MIN_CACHE_ENTRIES, &error);
+    if(!h && !tmp)
+    {
+      reply_error(output, error);
+      return;
+    }
+    ok = export_held_shm(h ? h : tmp, output + strlen(RS_SHM_PREFIX));
+    if(tmp) release_held(tmp);
+  }
+  else
+    ok = h ? export_held(h, input, output) : export_image(imgid, output);
+  flush_taps();
+  trace_render(input, output, ok, trace_wall_start, trace_cpu_start);
+  if(ok)
+    reply_ok(output, dt_get_wtime() - start);
+  else
+    reply_error(output, "export failed");
+}
+
+static void handle_hold(const char *input)
+{
+  if(g_hash_table_contains(held, input))
+  {
+    reply_ok(input, 0.0);
+    return;
+  }
+  const double start = dt_get_wtime();
+  const char *error = NULL;
+  rs_held_t *h = hold_image(input, 0, &error);
+  if(!h)
+  {
+    reply_error(input, error);
+    return;
+  }
+  g_hash_table_insert(held, g_strdup(input), h);
+  reply_ok(input, dt_get_wtime() - start);
+}
+
+// Returns FALSE on `quit`.
+static gboolean handle_request(gchar *line)
+{
+  g_strchomp(line);
+  if(!*line) return TRUE;
+
+  gchar **fields = g_strsplit(line, "\t", -1);
+  const guint n = g_strv_length(fields);
+  gboolean running = TRUE;
+
+  if(!g_strcmp0(fields[0], "quit"))
+  {
+    reply_ok(fields[0], 0.0);
+    running = FALSE;
+  }
+  else if(!g_strcmp0(fields[0], "render") && n == 4)
+    handle_render(fields);
+  else if(!g_strcmp0(fields[0], "hold") && n == 2)
+    handle_hold(fields[1]);
+  else if(!g_strcmp0(fields[0], "release") && n == 2)
+  {
+    g_hash_table_remove(held, fields[1]);
+    reply_ok(fields[1], 0.0);
+  }
+  else if(!g_strcmp0(fields[0], "env") && (n == 2 || n == 3))
+  {
+    if(n == 3 && *fields[2])
+      g_setenv(fields[1], fields[2], TRUE);
+    else
+      g_unsetenv(fields[1]);
+    reply_ok(fields[1], 0.0);
+  }
+  else
+    reply_error(fields[0], "malformed request");
+
+  g_strfreev(fields);
+  return running;
+}
+
+static void usage(const char *progname)
+{
+  fprintf(stderr, "usage: %s [--core <darktable options>]\n", progname);
+  fprintf(stderr, "reads `render\\t<input>\\t<xmp>\\t<output>` requests from stdin, see %s\n", __FILE__);
+}
+
+int main(int argc, char *arg[])
+{
+  int first_core_arg = argc;
+  for(int k = 1; k < argc; k++)
+  {
+    if(!strcmp(arg[k], "--core"))
+    {
+      first_core_arg = k + 1;
+      break;
+    }
+    usage(arg[0]);
+    exit(!strcmp(arg[k], "-h") || !strcmp(arg[k], "--help") ? 0 : 1);
+  }
+
+  // Same defaults as darktable-cli: a throwaway library, no sidecars.
+  const char *default_args[] = { arg[0], "--library", ":memory:", "--conf", "write_sidecar_files=never" };
+  const int num_default_args = G_N_ELEMENTS(default_args);
+  const int m_argc = num_default_args + (argc - first_core_arg);
+  char **m_arg = g_new0(char *, m_argc + 1);
+  for(int k = 0; k < num_default_args; k++) m_arg[k] = (char *)default_args[k];
+  for(int k = first_core_arg; k < argc; k++) m_arg[num_default_args + k - first_core_arg] = arg[k];
+
+  if(dt_init(m_argc, m_arg, FALSE, TRUE, NULL)) exit(1);
+
+  held = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, release_held);
+
+  printf(RS_PREFIX "ready\n");
+  fflush(stdout);
+
+  char *line = NULL;
+  size_t line_size = 0;
+  while(getline(&line, &line_size, stdin) >= 0)
+  {
+    if(!handle_request(line)) break;
+  }
+  free(line);
+
+  flush_taps();
+  g_hash_table_destroy(held);
+  dt_cleanup();
+  g_free(m_arg);
+  return 0;
+}
+
+// clang-format off
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.py
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
+// clang-format on
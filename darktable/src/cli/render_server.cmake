@@ -0,0 +1,21 @@
+# darktable-render-server, see render_server.c.
+#
+# Included from src/cli/CMakeLists.txt (the Dockerfile appends the include), so
+# it links and installs exactly like darktable-cli.
+add_executable(darktable-render-server render_server.c)
+
+set_target_properties(darktable-render-server PROPERTIES LINKER_LANGUAGE C)
+
+target_link_libraries(darktable-render-server lib_darktable)
+
+if (WIN32)
+  set_target_properties(darktable-render-server PROPERTIES LINK_FLAGS "-mconsole")
+endif()
+
+if(APPLE)
+  set_target_properties(darktable-render-server PROPERTIES INSTALL_RPATH @loader_path/../${CMAKE_INSTALL_LIBDIR}/darktable)
+else(APPLE)
+  set_target_properties(darktable-render-server PROPERTIES INSTALL_RPATH $ORIGIN/../${CMAKE_INSTALL_LIBDIR}/darktable)
+endif(APPLE)
+
+install(TARGETS darktable-render-server DESTINATION ${CMAKE_INSTALL_BINDIR} COMPONENT DTApplication)
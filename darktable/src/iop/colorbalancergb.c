@@ -458,6 +458,7 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
   const struct dt_iop_order_iccprofile_info_t *const work_profile
       = dt_ioppr_get_pipe_current_profile_info(self, piece->pipe);
   if(work_profile == NULL) return; // no point
+  dump_tmp_span_t span = dump_tmp_span_begin("process", "colorbalancergb");
 
   // work profile can't be fetched in commit_params since it is not yet initialised
   // work_profile->matrix_in === RGB_to_XYZ
@@ -500,7 +501,7 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
   // `in` is 4 channel as assumed below.
   const int ch = 4;
   fprintf(stderr, "ELEPHANT: [COLOR_BALANCE_RGB]. ch = %d, bpc = %d\n", ch, piece->bpc);
-  dump_tmp(in, roi_in, ch, "/tmp/colorbalancergb_in.tmp");
+  dump_tmp(in, roi_in, ch, "colorbalancergb_in");
 
   float *const restrict out = __builtin_assume_aligned(((float *const restrict)ovoid), 64);
   const float *const restrict gamut_LUT = __builtin_assume_aligned(((const float *const restrict)d->gamut_LUT), 64);
@@ -522,6 +523,7 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
   const size_t checker_1 = (mask_display) ? DT_PIXEL_APPLY_DPI(d->checker_size) : 0;
   const size_t checker_2 = 2 * checker_1;
 
+  dump_tmp_span_t pixel_span = dump_tmp_span_begin("omp", "colorbalancergb.pixels");
 #ifdef _OPENMP
 #pragma omp parallel for default(none) \
   dt_omp_firstprivate(in, out, roi_in, roi_out, d, g, mask_display, input_matrix, output_matrix, gamut_LUT, \
@@ -764,8 +766,10 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
       pix_out[3] = pix_in[3]; // alpha copy
     }
   }
+  dump_tmp_span_end(&pixel_span);
 
-  dump_tmp(out, roi_out, ch, "/tmp/colorbalancergb_out.tmp");
+  dump_tmp(out, roi_out, ch, "colorbalancergb_out");
+  dump_tmp_process_end(&span, roi_in, roi_out, ch);
 }
 
 
@@ -1015,8 +1015,9 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
 {
   fprintf(stderr, "ELEPHANT [COLOR_IN] process()\n");
 
+  dump_tmp_span_t span = dump_tmp_span_begin("process", "colorin");
   const float* in = (const float*)ivoid;
-  dump_tmp(in, roi_in, piece->colors, "/tmp/colorin_in.tmp");
+  dump_tmp(in, roi_in, piece->colors, "colorin_in");
 
   const dt_iop_colorin_data_t *const d = (dt_iop_colorin_data_t *)piece->data;
 
@@ -1028,18 +1029,23 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
   else if(!isnan(d->cmatrix[0][0]))
   {
     fprintf(stderr, "ELEPHANT [COLOR_IN]: d->cmatrix is defined, applying it\n");
+    dump_tmp_span_t region_span = dump_tmp_span_begin("omp", "colorin.cmatrix");
     process_cmatrix(self, piece, ivoid, ovoid, roi_in, roi_out);
+    dump_tmp_span_end(&region_span);
   }
   else
   {
     fprintf(stderr, "ELEPHANT [COLOR_IN]: process LCMS2\n");
+    dump_tmp_span_t region_span = dump_tmp_span_begin("omp", "colorin.lcms2");
     process_lcms2(self, piece, ivoid, ovoid, roi_in, roi_out);
+    dump_tmp_span_end(&region_span);
   }
 
   if(piece->pipe->mask_display & DT_DEV_PIXELPIPE_DISPLAY_MASK) dt_iop_alpha_copy(ivoid, ovoid, roi_out->width, roi_out->height);
 
   const float* out = (const float*)ovoid;
-  dump_tmp(out, roi_out, piece->colors, "/tmp/colorin_out.tmp");
+  dump_tmp(out, roi_out, piece->colors, "colorin_out");
+  dump_tmp_process_end(&span, roi_in, roi_out, piece->colors);
 }
 
 #if defined(__SSE2__)
@@ -1416,8 +1422,9 @@ void process_sse2(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, c
 {
   fprintf(stderr, "ELEPHANT [COLOR_IN]: colorin.c process_sse2()\n");
 
+  dump_tmp_span_t span = dump_tmp_span_begin("process", "colorin");
   const float* in = (const float*)ivoid;
-  dump_tmp(in, roi_in, piece->colors, "/tmp/colorin_in.tmp");
+  dump_tmp(in, roi_in, piece->colors, "colorin_in");
 
   const dt_iop_colorin_data_t *const d = (dt_iop_colorin_data_t *)piece->data;
 
@@ -1430,18 +1437,23 @@ void process_sse2(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, c
   {
     fprintf(stderr, "ELEPHANT [COLOR_IN]: d->cmatrix is defined, applying it in process_sse2_cmatrix\n");
     debug_print_color_matrix(d->cmatrix);
+    dump_tmp_span_t region_span = dump_tmp_span_begin("omp", "colorin.cmatrix_sse2");
     process_sse2_cmatrix(self, piece, ivoid, ovoid, roi_in, roi_out);
+    dump_tmp_span_end(&region_span);
   }
   else
   {
     fprintf(stderr, "ELEPHANT [COLOR_IN]: process sse2 LCMS2\n");
+    dump_tmp_span_t region_span = dump_tmp_span_begin("omp", "colorin.lcms2_sse2");
     process_sse2_lcms2(self, piece, ivoid, ovoid, roi_in, roi_out);
+    dump_tmp_span_end(&region_span);
   }
 
   if(piece->pipe->mask_display & DT_DEV_PIXELPIPE_DISPLAY_MASK) dt_iop_alpha_copy(ivoid, ovoid, roi_out->width, roi_out->height);
 
   const float* out = (const float*)ovoid;
-  dump_tmp(out, roi_out, piece->colors, "/tmp/colorin_out.tmp");
+  dump_tmp(out, roi_out, piece->colors, "colorin_out");
+  dump_tmp_process_end(&span, roi_in, roi_out, piece->colors);
 }
 #endif
 
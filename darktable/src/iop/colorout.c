@@ -348,12 +348,12 @@ error:
 }
 #endif
 
+__DT_CLONE_TARGETS__
 static void process_fastpath_apply_tonecurves(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece,
                                               const void *const ivoid, void *const ovoid,
                                               const dt_iop_roi_t *const roi_in,
                                               const dt_iop_roi_t *const roi_out)
 {
-  fprintf(stderr, "ELEPHANT [COLOR_OUT] tone curves don't look too complicated, let me know if you want these.\n");
   const dt_iop_colorout_data_t *const d = (dt_iop_colorout_data_t *)piece->data;
 
   if(!isnan(d->cmatrix[0][0]))
@@ -361,6 +361,7 @@ static void process_fastpath_apply_tonecurves(struct dt_iop_module_t *self, dt_d
     const size_t npixels = (size_t)roi_out->width * roi_out->height;
     float *const restrict out = (float *const)ovoid;
     // out is already converted to RGB from Lab.
+    dump_tmp_span_t span = dump_tmp_span_begin("omp", "colorout.tonecurves");
 
     // do we have any lut to apply, or is this a linear profile?
     if((d->lut[0][0] >= 0.0f) && (d->lut[1][0] >= 0.0f) && (d->lut[2][0] >= 0.0f))
@@ -398,16 +399,18 @@ static void process_fastpath_apply_tonecurves(struct dt_iop_module_t *self, dt_d
         }
       }
     }
+    dump_tmp_span_end(&span);
   }
 }
 
+__DT_CLONE_TARGETS__
 void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const void *const ivoid,
              void *const ovoid, const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out)
 {
-  fprintf(stderr, "ELEPHANT: colorout.c process()\n");
   if (!dt_iop_have_required_input_format(4 /*we need full-color pixels*/, self, piece->colors,
                                          ivoid, ovoid, roi_in, roi_out))
     return;
+  dump_tmp_span_t span = dump_tmp_span_begin("process", "colorout");
   const dt_iop_colorout_data_t *const d = (dt_iop_colorout_data_t *)piece->data;
   const int gamutcheck = (d->mode == DT_PROFILE_GAMUTCHECK);
   const size_t npixels = (size_t)roi_out->width * roi_out->height;
@@ -415,26 +418,22 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
 
   {
     const float* in = (const float*)ivoid;
-    dump_tmp(in, roi_in, piece->colors, "/tmp/colorout_in.tmp");
+    dump_tmp(in, roi_in, piece->colors, "colorout_in");
   }
 
   if(d->type == DT_COLORSPACE_LAB)
   {
-    fprintf(stderr, "ELEPHANT [COLOR_OUT]: d->type is DT_COLORSPACE_LAB, copying in -> out\n");
-
     dt_iop_image_copy_by_size(ovoid, ivoid, roi_out->width, roi_out->height, piece->colors);
   }
   else if(!isnan(d->cmatrix[0][0]))
   {
-    fprintf(stderr, "ELEPHANT [COLOR_OUT]: d->cmatrix is defined, applying it\n");
-    debug_print_color_matrix(d->cmatrix);
-
     const float *const restrict in = (const float *const)ivoid;
     dt_colormatrix_t cmatrix;
     transpose_3xSSE(d->cmatrix, cmatrix);
 
 // fprintf(stderr,"Using cmatrix codepath\n");
 // convert to rgb using matrix
+    dump_tmp_span_t cmatrix_span = dump_tmp_span_begin("omp", "colorout.cmatrix");
 #ifdef _OPENMP
 #pragma omp parallel for default(none) \
     dt_omp_firstprivate(in, out, npixels) \
@@ -449,15 +448,14 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
       dt_apply_transposed_color_matrix(xyz, cmatrix, rgb);
       copy_pixel(out + k, rgb);
     }
+    dump_tmp_span_end(&cmatrix_span);
 
-    fprintf(stderr, "ELEPHANT [COLOR_OUT]: applying tone curves\n");
     process_fastpath_apply_tonecurves(self, piece, in, out, roi_in, roi_out);
   }
   else
   {
-    fprintf(stderr, "ELEPHANT [COLOR_OUT]: d->xform is defined, applying it\n");
-
 // fprintf(stderr,"Using xform codepath\n");
+    dump_tmp_span_t xform_span = dump_tmp_span_begin("omp", "colorout.xform");
 #ifdef _OPENMP
 #pragma omp parallel for default(none) \
     dt_omp_firstprivate(d, gamutcheck, ivoid, out, roi_out) \
@@ -483,19 +481,29 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
         }
       }
     }
+    dump_tmp_span_end(&xform_span);
   }
 
   if(piece->pipe->mask_display & DT_DEV_PIXELPIPE_DISPLAY_MASK)
     dt_iop_alpha_copy(ivoid, ovoid, roi_out->width, roi_out->height);
 
-  dump_tmp(out, roi_out, piece->colors, "/tmp/colorout_out.tmp");
+  dump_tmp(out, roi_out, piece->colors, "colorout_out");
+  dump_tmp_process_end(&span, roi_in, roi_out, piece->colors);
 }
 
 #if defined(__SSE__)
 void process_sse2(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const void *const ivoid,
                   void *const ovoid, const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out)
 {
-  fprintf(stderr, "ELEPHANT: colorout.c process_sse2()\n");
+  // darktable picks this codepath on every SSE2 CPU. With AVX2, the AVX2 or AVX-512 clone of process() that the
+  // CPU selects at runtime (__DT_CLONE_TARGETS__) is faster than these 128-bit intrinsics.
+  if(__builtin_cpu_supports("avx2"))
+  {
+    process(self, piece, ivoid, ovoid, roi_in, roi_out);
+    return;
+  }
+
+  dump_tmp_span_t span = dump_tmp_span_begin("process", "colorout");
   const dt_iop_colorout_data_t *const d = (dt_iop_colorout_data_t *)piece->data;
   const int ch = piece->colors;
   const int gamutcheck = (d->mode == DT_PROFILE_GAMUTCHECK);
@@ -504,25 +512,22 @@ void process_sse2(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, c
 
   {
     const float* in = (const float*)ivoid;
-    dump_tmp(in, roi_in, piece->colors, "/tmp/colorout_in.tmp");
+    dump_tmp(in, roi_in, piece->colors, "colorout_in");
   }
 
   if(d->type == DT_COLORSPACE_LAB)
   {
-    fprintf(stderr, "ELEPHANT [COLOR_OUT]: d->type is DT_COLORSPACE_LAB, copying in -> out\n");
     dt_iop_image_copy_by_size(ovoid, ivoid, roi_out->width, roi_out->height, ch);
   }
   else if(!isnan(d->cmatrix[0][0]))
   {
-    fprintf(stderr, "ELEPHANT [COLOR_OUT]: d->cmatrix is defined, applying it\n");
-    debug_print_color_matrix(d->cmatrix);
-
     const float *const restrict in = (const float *const)ivoid;
     const __m128 m0 = _mm_set_ps(0.0f, d->cmatrix[2][0], d->cmatrix[1][0], d->cmatrix[0][0]);
     const __m128 m1 = _mm_set_ps(0.0f, d->cmatrix[2][1], d->cmatrix[1][1], d->cmatrix[0][1]);
     const __m128 m2 = _mm_set_ps(0.0f, d->cmatrix[2][2], d->cmatrix[1][2], d->cmatrix[0][2]);
 // fprintf(stderr,"Using cmatrix codepath\n");
 // convert to rgb using matrix
+    dump_tmp_span_t cmatrix_span = dump_tmp_span_begin("omp", "colorout.cmatrix");
 #ifdef _OPENMP
 #pragma omp parallel for default(none) \
     dt_omp_firstprivate(ch, npixels, m0, m1, m2, in, out)    \
@@ -537,15 +542,15 @@ void process_sse2(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, c
       _mm_stream_ps(out + j, t);
     }
     _mm_sfence();
+    dump_tmp_span_end(&cmatrix_span);
 
-    fprintf(stderr, "ELEPHANT [COLOR_OUT]: applying tone curves\n");
     process_fastpath_apply_tonecurves(self, piece, ivoid, ovoid, roi_in, roi_out);
   }
   else
   {
-    fprintf(stderr, "ELEPHANT [COLOR_OUT]: d->xform is defined, applying it\n");
     // fprintf(stderr,"Using xform codepath\n");
     const __m128 outofgamutpixel = _mm_set_ps(0.0f, 1.0f, 1.0f, 0.0f);
+    dump_tmp_span_t xform_span = dump_tmp_span_begin("omp", "colorout.xform");
 #ifdef _OPENMP
 #pragma omp parallel for default(none) \
     dt_omp_firstprivate(ch, d, ivoid, gamutcheck, outofgamutpixel, out, roi_out) \
@@ -575,10 +580,12 @@ void process_sse2(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, c
       }
     }
     _mm_sfence();
+    dump_tmp_span_end(&xform_span);
   }
 
   if(piece->pipe->mask_display & DT_DEV_PIXELPIPE_DISPLAY_MASK) dt_iop_alpha_copy(ivoid, ovoid, roi_out->width, roi_out->height);
-  dump_tmp(out, roi_out, piece->colors, "/tmp/colorout_out.tmp");
+  dump_tmp(out, roi_out, piece->colors, "colorout_out");
+  dump_tmp_process_end(&span, roi_in, roi_out, piece->colors);
 }
 #endif
 
@@ -1,12 +1,168 @@
+#include <math.h>
+#include <stdint.h>
 #include <stdio.h>
+#include <string.h>
+#include <tiffio.h>
+#include <time.h>
+#include <unistd.h>
+#include <zlib.h>
+#if defined(__GLIBC__)
+#include <malloc.h>
+#endif
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 #include "gui/gtk.h"
+#include "iop/dump_tmp_select.h"
 
-inline void dump_tmp(const float* buffer, const dt_iop_roi_t* roi, int channels, const char* filename) {
-  fprintf(stderr, "Writing: %s\n", filename);
-  FILE* f = g_fopen(filename, "wb");
+// ImageStack TMP type codes, see
+// https://github.com/abadams/ImageStack/blob/master/src/FileTMP.cpp
+#define DT_TMP_TYPE_FLOAT32 0
+#define DT_TMP_TYPE_UINT16 4
+// Not in ImageStack: IEEE 754 binary16.
+#define DT_TMP_TYPE_FLOAT16 10
+
+// Flags or'ed into the high bits of the type code. They are not part of the
+// ImageStack format, so only py/loadTMP.py understands files carrying them.
+//
+// DT_TMP_FLAG_INTERLEAVED: samples are stored (frames, height, width, channels)
+// like the pixelpipe buffers, instead of ImageStack's channel-major planes.
+// DT_TMP_FLAG_NORMALIZED: integer samples map [0, max] to [0.0, 1.0].
+// DT_TMP_FLAG_DEFLATE: the samples are split into bands of rows that are
+// zlib-compressed independently, see dump_tmp_compressed().
+#define DT_TMP_FLAG_INTERLEAVED (1 << 16)
+#define DT_TMP_FLAG_NORMALIZED (1 << 17)
+#define DT_TMP_FLAG_DEFLATE (1 << 18)
+
+typedef enum dump_tmp_encoding_t {
+  DUMP_TMP_FLOAT32,
+  DUMP_TMP_FLOAT16,
+  DUMP_TMP_UINT16,  // Normalized, clamped to [0, 1].
+} dump_tmp_encoding_t;
+
+typedef enum dump_tmp_layout_t {
+  DUMP_TMP_PLANAR,
+  DUMP_TMP_INTERLEAVED,
+} dump_tmp_layout_t;
+
+typedef enum dump_tmp_filter_t {
+  DUMP_TMP_BOX,
+  DUMP_TMP_BILINEAR,
+} dump_tmp_filter_t;
+
+typedef enum dump_tmp_format_t {
+  DUMP_TMP_FORMAT_TMP,
+  DUMP_TMP_FORMAT_TIFF,
+  DUMP_TMP_FORMAT_STATS,  // Summary statistics as JSON, see dump_tmp_stats().
+} dump_tmp_format_t;
+
+// How one tap is written, resolved from the environment by dump_tmp().
+typedef struct dump_tmp_options_t {
+  dump_tmp_format_t format;
+  dump_tmp_layout_t layout;
+  dump_tmp_encoding_t encoding;
+  int compression_level;  // zlib level, 0 writes uncompressed files.
+  int band_rows;
+  int crop_x, crop_y, crop_width, crop_height;  // crop_width == 0: no crop.
+  int downsample;  // Integer factor, 1: full resolution.
+  dump_tmp_filter_t filter;
+  gboolean atomic;  // Write to a temporary file, then rename it into place.
+  int stats_bins;  // Histogram bins per channel of DUMP_TMP_FORMAT_STATS.
+} dump_tmp_options_t;
+
+static inline size_t dump_tmp_encoding_size(const dump_tmp_encoding_t encoding) {
+  return encoding == DUMP_TMP_FLOAT32 ? sizeof(float) : sizeof(uint16_t);
+}
+
+static inline int32_t dump_tmp_type_code(const dump_tmp_options_t* options) {
+  int32_t type = DT_TMP_TYPE_FLOAT32;
+  if (options->encoding == DUMP_TMP_FLOAT16) type = DT_TMP_TYPE_FLOAT16;
+  if (options->encoding == DUMP_TMP_UINT16) type = DT_TMP_TYPE_UINT16 | DT_TMP_FLAG_NORMALIZED;
+  if (options->layout == DUMP_TMP_INTERLEAVED) type |= DT_TMP_FLAG_INTERLEAVED;
+  if (options->compression_level > 0) type |= DT_TMP_FLAG_DEFLATE;
+  return type;
+}
+
+// Round-to-nearest-even float -> binary16, saturating to infinity.
+static inline uint16_t dump_tmp_float_to_half(const float f) {
+  union { float f; uint32_t u; } v = { .f = f };
+  const uint16_t sign = (v.u >> 16) & 0x8000;
+  uint32_t x = v.u & 0x7fffffff;
+
+  if (x >= 0x7f800000) return sign | 0x7c00 | (x > 0x7f800000 ? 0x200 : 0);  // inf, nan
+  if (x >= 0x477ff000) return sign | 0x7c00;  // rounds to >= 65520: overflow
+  if (x < 0x38800000) {
+    // Below 2^-14: subnormal (or zero) in half precision, in units of 2^-24.
+    v.u = x;
+    return sign | (uint16_t)nearbyintf(v.f * 16777216.0f);
+  }
+  x += 0xfff + ((x >> 13) & 1);
+  return sign | (uint16_t)((x - ((uint32_t)(127 - 15) << 23)) >> 13);
+}
+
+static inline float dump_tmp_half_to_float(const uint16_t h) {
+  union { float f; uint32_t u; } v;
+  const uint32_t sign = (uint32_t)(h & 0x8000) << 16;
+  const uint32_t exponent = (h >> 10) & 0x1f;
+  const uint32_t mantissa = h & 0x3ff;
+  if (exponent == 0) {
+    // Zero or subnormal, in units of 2^-24.
+    v.f = mantissa * (1.0f / 16777216.0f);
+    v.u |= sign;
+  } else if (exponent == 31) {
+    v.u = sign | 0x7f800000 | (mantissa << 13);  // inf, nan
+  } else {
+    v.u = sign | ((exponent + 127 - 15) << 23) | (mantissa << 13);
+  }
+  return v.f;
+}
+
+// The float32 value a reader decodes from the sample v written with encoding,
+// e.g. loadTMP's v / 65535 for normalized uint16.
+static inline float dump_tmp_decoded(const float v, const dump_tmp_encoding_t encoding) {
+  if (encoding == DUMP_TMP_FLOAT16) return dump_tmp_half_to_float(dump_tmp_float_to_half(v));
+  if (encoding == DUMP_TMP_UINT16)
+    return (float)(uint16_t)((v > 0.0f ? fminf(v, 1.0f) : 0.0f) * 65535.0f + 0.5f) / 65535.0f;
+  return v;
+}
+
+// Encodes n samples src[0], src[stride], src[2 * stride], ... into dst.
+static inline void dump_tmp_encode(const float* src, const size_t stride, void* dst, const size_t n,
+                                   const dump_tmp_encoding_t encoding) {
+  if (encoding == DUMP_TMP_FLOAT32) {
+    float* out = (float*)dst;
+#ifdef _OPENMP
+#pragma omp parallel for default(none) dt_omp_firstprivate(src, stride, out, n) schedule(static)
+#endif
+    for (size_t k = 0; k < n; k++) out[k] = src[k * stride];
+  } else if (encoding == DUMP_TMP_FLOAT16) {
+    uint16_t* out = (uint16_t*)dst;
+#ifdef _OPENMP
+#pragma omp parallel for default(none) dt_omp_firstprivate(src, stride, out, n) schedule(static)
+#endif
+    for (size_t k = 0; k < n; k++) out[k] = dump_tmp_float_to_half(src[k * stride]);
+  } else {
+    uint16_t* out = (uint16_t*)dst;
+#ifdef _OPENMP
+#pragma omp parallel for default(none) dt_omp_firstprivate(src, stride, out, n) schedule(static)
+#endif
+    for (size_t k = 0; k < n; k++) {
+      // Written so that NaN maps to 0.
+      const float v = src[k * stride];
+      out[k] = (uint16_t)((v > 0.0f ? fminf(v, 1.0f) : 0.0f) * 65535.0f + 0.5f);
+    }
+  }
+}
+
+// With DT_TAP_VERBOSE set (and not "0"), every tap file is announced on
+// stderr as it is written.
+static inline void dump_tmp_log_write(const char* filename) {
+  const char* verbose = g_getenv("DT_TAP_VERBOSE");
+  if (verbose && *verbose && g_strcmp0(verbose, "0")) fprintf(stderr, "Writing: %s\n", filename);
+}
 
-  const int32_t type = 0; // float32
+static inline void dump_tmp_write_header(FILE* f, const dt_iop_roi_t* roi, int channels, int32_t type) {
   const int32_t frames = 1;
 
   fwrite(&(roi->width), 4, 1, f);
@@ -14,24 +170,1015 @@ inline void dump_tmp(const float* buffer, const dt_iop_roi_t* roi, int channels,
   fwrite(&frames, 4, 1, f);
   fwrite(&channels, 4, 1, f);
   fwrite(&type, 4, 1, f);
+}
+
+// Writes an ImageStack TMP file (planar, channel-major).
+//
+// The interleaved pipe buffer is transposed (and encoded) one channel at a
+// time into a reusable plane, which is then emitted with a single fwrite().
+// That costs one extra plane of memory (1/channels of the buffer) but replaces
+// one libc call per sample with one per channel.
+static inline void dump_tmp_planar(const float* buffer, const dt_iop_roi_t* roi, int channels,
+                                   const dump_tmp_options_t* options, const char* filename) {
+  dump_tmp_log_write(filename);
+  FILE* f = g_fopen(filename, "wb");
+  if (!f) {
+    fprintf(stderr, "dump_tmp: could not open %s for writing\n", filename);
+    return;
+  }
+
+  dump_tmp_write_header(f, roi, channels, dump_tmp_type_code(options));
+
+  const size_t npixels = (size_t)roi->width * roi->height;
+  const size_t elem_size = dump_tmp_encoding_size(options->encoding);
+  void* plane = dt_alloc_align(64, npixels * elem_size);
+  if (!plane) {
+    fprintf(stderr, "dump_tmp: out of memory, %s is truncated\n", filename);
+    fclose(f);
+    return;
+  }
 
   for (int c = 0; c < channels; c++) {
-    for (int y = 0; y < roi->height; y++) {
-      for (int x = 0; x < roi->width; x++) {
-        const int index = y * roi->width * channels + x * channels + c;
-        fwrite(&(buffer[index]), 4, 1, f);
+    dump_tmp_encode(buffer + c, channels, plane, npixels, options->encoding);
+    if (fwrite(plane, elem_size, npixels, f) != npixels) {
+      fprintf(stderr, "dump_tmp: short write to %s\n", filename);
+      break;
+    }
+  }
+
+  dt_free_align(plane);
+  fclose(f);
+}
+
+// Writes the pipe buffer in its own order, in a TMP file flagged
+// DT_TMP_FLAG_INTERLEAVED. float32 is written with one fwrite() straight from
+// the buffer; other encodings go through a small staging buffer.
+static inline void dump_tmp_interleaved(const float* buffer, const dt_iop_roi_t* roi, int channels,
+                                        const dump_tmp_options_t* options, const char* filename) {
+  dump_tmp_log_write(filename);
+  FILE* f = g_fopen(filename, "wb");
+  if (!f) {
+    fprintf(stderr, "dump_tmp: could not open %s for writing\n", filename);
+    return;
+  }
+
+  dump_tmp_write_header(f, roi, channels, dump_tmp_type_code(options));
+
+  const size_t nfloats = (size_t)roi->width * roi->height * channels;
+  if (options->encoding == DUMP_TMP_FLOAT32) {
+    if (fwrite(buffer, sizeof(float), nfloats, f) != nfloats) {
+      fprintf(stderr, "dump_tmp: short write to %s\n", filename);
+    }
+    fclose(f);
+    return;
+  }
+
+  // Encode and write 1M samples at a time.
+  const size_t block = (size_t)1 << 20;
+  const size_t elem_size = dump_tmp_encoding_size(options->encoding);
+  void* staging = dt_alloc_align(64, MIN(block, nfloats) * elem_size);
+  if (!staging) {
+    fprintf(stderr, "dump_tmp: out of memory, %s is truncated\n", filename);
+    fclose(f);
+    return;
+  }
+  for (size_t k = 0; k < nfloats; k += block) {
+    const size_t n = MIN(block, nfloats - k);
+    dump_tmp_encode(buffer + k, 1, staging, n, options->encoding);
+    if (fwrite(staging, elem_size, n, f) != n) {
+      fprintf(stderr, "dump_tmp: short write to %s\n", filename);
+      break;
+    }
+  }
+  dt_free_align(staging);
+  fclose(f);
+}
+
+// Writes a TMP file whose samples are deflate-compressed in bands.
+//
+// After the usual 5-word header come
+//   int32 band_rows
+//   int32 num_bands
+//   uint64 offsets[num_bands + 1]  (file offsets, the last one is the file size)
+// followed by the compressed bands. Each plane (one per channel in the planar
+// layout, a single one when interleaved) is cut into bands of band_rows rows,
+// in plane-major order; the last band of a plane may be shorter. Bands are
+// encoded and compressed in parallel, and a reader can decompress only the
+// bands covering the rows it needs.
+static inline void dump_tmp_compressed(const float* buffer, const dt_iop_roi_t* roi, int channels,
+                                       const dump_tmp_options_t* options, const char* filename) {
+  dump_tmp_log_write(filename);
+  FILE* f = g_fopen(filename, "wb");
+  if (!f) {
+    fprintf(stderr, "dump_tmp: could not open %s for writing\n", filename);
+    return;
+  }
+
+  const gboolean planar = options->layout == DUMP_TMP_PLANAR;
+  const int width = roi->width;
+  const int height = roi->height;
+  const int band_rows = options->band_rows;
+  const int level = options->compression_level;
+  const dump_tmp_encoding_t encoding = options->encoding;
+  const size_t elem_size = dump_tmp_encoding_size(encoding);
+  const size_t row_samples = planar ? (size_t)width : (size_t)width * channels;
+  const int bands_per_plane = (height + band_rows - 1) / band_rows;
+  const int num_bands = (planar ? channels : 1) * bands_per_plane;
+
+  Bytef** blobs = g_new0(Bytef*, num_bands);
+  uLongf* blob_sizes = g_new0(uLongf, num_bands);
+  int failed = 0;
+
+#ifdef _OPENMP
+#pragma omp parallel for default(none) \
+  dt_omp_firstprivate(buffer, channels, planar, width, height, band_rows, level, encoding, elem_size, \
+                      row_samples, bands_per_plane, num_bands, blobs, blob_sizes) \
+  reduction(|| : failed) schedule(dynamic)
+#endif
+  for (int b = 0; b < num_bands; b++) {
+    const int plane = b / bands_per_plane;
+    const int y0 = (b % bands_per_plane) * band_rows;
+    const size_t n = (size_t)MIN(band_rows, height - y0) * row_samples;
+    void* raw = g_malloc(n * elem_size);
+    if (planar) {
+      dump_tmp_encode(buffer + (size_t)y0 * width * channels + plane, channels, raw, n, encoding);
+    } else {
+      dump_tmp_encode(buffer + (size_t)y0 * row_samples, 1, raw, n, encoding);
+    }
+    blob_sizes[b] = compressBound(n * elem_size);
+    blobs[b] = g_malloc(blob_sizes[b]);
+    if (compress2(blobs[b], &blob_sizes[b], raw, n * elem_size, level) != Z_OK) failed = 1;
+    g_free(raw);
+  }
+
+  if (failed) {
+    fprintf(stderr, "dump_tmp: compression failed, %s is truncated\n", filename);
+  } else {
+    dump_tmp_write_header(f, roi, channels, dump_tmp_type_code(options));
+    const int32_t band_header[2] = { band_rows, num_bands };
+    fwrite(band_header, sizeof(int32_t), 2, f);
+
+    uint64_t* offsets = g_new(uint64_t, num_bands + 1);
+    offsets[0] = 5 * sizeof(int32_t) + sizeof(band_header) + (num_bands + 1) * sizeof(uint64_t);
+    for (int b = 0; b < num_bands; b++) offsets[b + 1] = offsets[b] + blob_sizes[b];
+    fwrite(offsets, sizeof(uint64_t), num_bands + 1, f);
+    g_free(offsets);
+
+    for (int b = 0; b < num_bands; b++) {
+      if (fwrite(blobs[b], 1, blob_sizes[b], f) != blob_sizes[b]) {
+        fprintf(stderr, "dump_tmp: short write to %s\n", filename);
+        break;
       }
     }
   }
+
+  for (int b = 0; b < num_bands; b++) g_free(blobs[b]);
+  g_free(blobs);
+  g_free(blob_sizes);
   fclose(f);
 }
 
-inline void debug_print_roi(const dt_iop_roi_t *const roi) {
+// Writes the tap as the TIFF py/tmp2tiff.py would have produced from the TMP
+// file: the first min(channels, 3) channels, contiguous, as float32. Whatever
+// the tap's encoding, both writers store float32, holding the values a TMP
+// reader decodes (so a uint16 tap is quantized to n / 65535, a float16 tap
+// rounded to half precision). Deflate is used when DT_TMP_COMPRESSION asks
+// for it.
+static inline void dump_tmp_tiff(const float* buffer, const dt_iop_roi_t* roi, int channels,
+                                 const dump_tmp_options_t* options, const char* filename) {
+  dump_tmp_log_write(filename);
+  TIFF* tif = TIFFOpen(filename, "w");
+  if (!tif) {
+    fprintf(stderr, "dump_tmp: could not open %s for writing\n", filename);
+    return;
+  }
+
+  const int width = roi->width;
+  const int height = roi->height;
+  const int spp = MIN(channels, 3);
+  const dump_tmp_encoding_t encoding = options->encoding;
+
+  TIFFSetField(tif, TIFFTAG_IMAGEWIDTH, width);
+  TIFFSetField(tif, TIFFTAG_IMAGELENGTH, height);
+  TIFFSetField(tif, TIFFTAG_SAMPLESPERPIXEL, spp);
+  TIFFSetField(tif, TIFFTAG_BITSPERSAMPLE, 32);
+  TIFFSetField(tif, TIFFTAG_SAMPLEFORMAT, SAMPLEFORMAT_IEEEFP);
+  TIFFSetField(tif, TIFFTAG_PLANARCONFIG, PLANARCONFIG_CONTIG);
+  TIFFSetField(tif, TIFFTAG_PHOTOMETRIC, spp == 3 ? PHOTOMETRIC_RGB : PHOTOMETRIC_MINISBLACK);
+  if (spp == 2) {
+    const uint16_t extra = EXTRASAMPLE_UNSPECIFIED;
+    TIFFSetField(tif, TIFFTAG_EXTRASAMPLES, 1, &extra);
+  }
+  if (options->compression_level > 0) {
+    TIFFSetField(tif, TIFFTAG_COMPRESSION, COMPRESSION_ADOBE_DEFLATE);
+    TIFFSetField(tif, TIFFTAG_ZIPQUALITY, options->compression_level);
+  } else {
+    TIFFSetField(tif, TIFFTAG_COMPRESSION, COMPRESSION_NONE);
+  }
+  TIFFSetField(tif, TIFFTAG_ROWSPERSTRIP, TIFFDefaultStripSize(tif, 0));
+
+  // Bands of rows are converted in parallel, then written scanline by
+  // scanline: libtiff itself is sequential.
+  const size_t row_samples = (size_t)width * spp;
+  const int band_rows = MAX(1, MIN(options->band_rows, height));
+  float* band = dt_alloc_align_float((size_t)band_rows * row_samples);
+  if (!band) {
+    fprintf(stderr, "dump_tmp: out of memory, %s is truncated\n", filename);
+  } else {
+    gboolean ok = TRUE;
+    for (int y0 = 0; y0 < height && ok; y0 += band_rows) {
+      const int rows = MIN(band_rows, height - y0);
+#ifdef _OPENMP
+#pragma omp parallel for default(none) \
+  dt_omp_firstprivate(buffer, band, y0, rows, width, channels, spp, row_samples, encoding) schedule(static)
+#endif
+      for (int r = 0; r < rows; r++) {
+        const float* in = buffer + (size_t)(y0 + r) * width * channels;
+        float* out = band + (size_t)r * row_samples;
+        for (int x = 0; x < width; x++)
+          for (int c = 0; c < spp; c++)
+            out[(size_t)x * spp + c] = dump_tmp_decoded(in[(size_t)x * channels + c], encoding);
+      }
+      for (int r = 0; r < rows && ok; r++) {
+        if (TIFFWriteScanline(tif, band + (size_t)r * row_samples, y0 + r, 0) < 0) {
+          fprintf(stderr, "dump_tmp: short write to %s\n", filename);
+          ok = FALSE;
+        }
+      }
+    }
+    dt_free_align(band);
+  }
+  TIFFClose(tif);
+}
+
+// Writes summary statistics of the tap instead of its samples, as a JSON
+// object of a few KB:
+//   {"width": .., "height": .., "channels": .., "bins": ..,
+//    "stats": [{"min": .., "max": .., "mean": .., "std": .., "nonfinite": ..,
+//               "percentiles": {"1": .., "5": .., ..., "99": ..},
+//               "histogram": [..]}, ...]}
+// with one entry per channel (a raw mosaic is a single channel). At most the
+// first DUMP_TMP_STATS_MAX_CHANNELS channels are summarised, and "channels"
+// counts those, so it always matches the length of "stats". NaN and
+// infinite samples are only counted in "nonfinite". The histogram has `bins`
+// equal bins spanning [min, max] of that channel; the percentiles are
+// interpolated within the histogram's bins, so they are accurate to about
+// (max - min) / bins.
+//
+// Both passes over the buffer are OpenMP reductions, the first for the
+// moments and extremes, the second for the histogram.
+#define DUMP_TMP_STATS_MAX_CHANNELS 4
+
+static inline void dump_tmp_stats(const float* buffer, const dt_iop_roi_t* roi, int channels,
+                                  const dump_tmp_options_t* options, const char* filename) {
+  dump_tmp_log_write(filename);
+  const int ch = MIN(channels, DUMP_TMP_STATS_MAX_CHANNELS);
+  const int bins = options->stats_bins;
+  const size_t npixels = (size_t)roi->width * roi->height;
+
+  float mn[DUMP_TMP_STATS_MAX_CHANNELS], mx[DUMP_TMP_STATS_MAX_CHANNELS];
+  double sum[DUMP_TMP_STATS_MAX_CHANNELS] = { 0.0 }, sum2[DUMP_TMP_STATS_MAX_CHANNELS] = { 0.0 };
+  size_t nonfinite[DUMP_TMP_STATS_MAX_CHANNELS] = { 0 };
+  for (int c = 0; c < DUMP_TMP_STATS_MAX_CHANNELS; c++) {
+    mn[c] = INFINITY;
+    mx[c] = -INFINITY;
+  }
+
+#ifdef _OPENMP
+#pragma omp parallel for default(none) dt_omp_firstprivate(buffer, channels, ch, npixels) \
+  reduction(min : mn[:DUMP_TMP_STATS_MAX_CHANNELS]) reduction(max : mx[:DUMP_TMP_STATS_MAX_CHANNELS]) \
+  reduction(+ : sum[:DUMP_TMP_STATS_MAX_CHANNELS], sum2[:DUMP_TMP_STATS_MAX_CHANNELS], \
+            nonfinite[:DUMP_TMP_STATS_MAX_CHANNELS]) \
+  schedule(static)
+#endif
+  for (size_t k = 0; k < npixels; k++) {
+    for (int c = 0; c < ch; c++) {
+      const float v = buffer[k * channels + c];
+      if (!isfinite(v)) {
+        nonfinite[c]++;
+        continue;
+      }
+      mn[c] = fminf(mn[c], v);
+      mx[c] = fmaxf(mx[c], v);
+      sum[c] += v;
+      sum2[c] += (double)v * v;
+    }
+  }
+
+  float scale[DUMP_TMP_STATS_MAX_CHANNELS];
+  for (int c = 0; c < ch; c++) scale[c] = mx[c] > mn[c] ? bins / (mx[c] - mn[c]) : 0.0f;
+  const size_t nhist = (size_t)ch * bins;
+  uint64_t* hist = g_new0(uint64_t, nhist);
+
+#ifdef _OPENMP
+#pragma omp parallel for default(none) dt_omp_firstprivate(buffer, channels, ch, npixels, bins, mn, scale, nhist) \
+  reduction(+ : hist[:nhist]) schedule(static)
+#endif
+  for (size_t k = 0; k < npixels; k++) {
+    for (int c = 0; c < ch; c++) {
+      const float v = buffer[k * channels + c];
+      if (!isfinite(v)) continue;
+      const int bin = MIN((int)((v - mn[c]) * scale[c]), bins - 1);
+      hist[(size_t)c * bins + bin]++;
+    }
+  }
+
+  static const int percentiles[] = { 1, 5, 10, 25, 50, 75, 90, 95, 99 };
+  GString* json = g_string_new(NULL);
+  g_string_append_printf(json, "{\"width\": %d, \"height\": %d, \"channels\": %d, \"bins\": %d, \"stats\": [",
+                         roi->width, roi->height, ch, bins);
+  for (int c = 0; c < ch; c++) {
+    const uint64_t* h = hist + (size_t)c * bins;
+    const size_t n = npixels - nonfinite[c];
+    const double mean = n ? sum[c] / n : NAN;
+    const double var = n ? fmax(sum2[c] / n - mean * mean, 0.0) : NAN;
+    char v[4][G_ASCII_DTOSTR_BUF_SIZE];
+    // JSON has no NaN: channels without finite samples get nulls.
+    g_string_append_printf(json, "%s\n {\"min\": %s, \"max\": %s, \"mean\": %s, \"std\": %s, \"nonfinite\": %zu, "
+                           "\"percentiles\": {", c ? "," : "",
+                           n ? g_ascii_dtostr(v[0], sizeof(v[0]), mn[c]) : "null",
+                           n ? g_ascii_dtostr(v[1], sizeof(v[1]), mx[c]) : "null",
+                           n ? g_ascii_dtostr(v[2], sizeof(v[2]), mean) : "null",
+                           n ? g_ascii_dtostr(v[3], sizeof(v[3]), sqrt(var)) : "null", nonfinite[c]);
+    for (size_t p = 0; p < G_N_ELEMENTS(percentiles); p++) {
+      // The sample of rank target lies in the first bin whose cumulative count
+      // exceeds it; interpolate linearly within that bin.
+      const double target = percentiles[p] / 100.0 * n;
+      uint64_t below = 0;
+      int b = 0;
+      while (b < bins - 1 && below + h[b] <= target) below += h[b++];
+      const double frac = h[b] ? CLAMP((target - below) / h[b], 0.0, 1.0) : 0.0;
+      const double value = scale[c] > 0.0f ? mn[c] + (b + frac) / scale[c] : mn[c];
+      g_string_append_printf(json, "%s\"%d\": %s", p ? ", " : "", percentiles[p],
+                             n ? g_ascii_dtostr(v[0], sizeof(v[0]), value) : "null");
+    }
+    g_string_append(json, "}, \"histogram\": [");
+    for (int b = 0; b < bins; b++)
+      g_string_append_printf(json, "%s%" G_GUINT64_FORMAT, b ? "," : "", (guint64)h[b]);
+    g_string_append(json, "]}");
+  }
+  g_string_append(json, "]}\n");
+
+  FILE* f = g_fopen(filename, "wb");
+  if (!f) {
+    fprintf(stderr, "dump_tmp: could not open %s for writing\n", filename);
+  } else {
+    if (fwrite(json->str, 1, json->len, f) != json->len) fprintf(stderr, "dump_tmp: short write to %s\n", filename);
+    fclose(f);
+  }
+  g_string_free(json, TRUE);
+  g_free(hist);
+}
+
+// Returns the file a tap named `tap` (e.g. "exposure_in") is written to:
+//   $DT_TAP_DIR/$DT_TAP_PREFIX<tap><extension>
+// DT_TAP_DIR defaults to /tmp and DT_TAP_PREFIX to the empty string. Giving
+// every concurrent darktable-cli its own directory or prefix keeps parallel
+// renders from clobbering each other's taps. Free with g_free().
+static inline gchar* dump_tmp_path(const char* tap, const char* extension) {
+  const char* dir = g_getenv("DT_TAP_DIR");
+  const char* prefix = g_getenv("DT_TAP_PREFIX");
+  gchar* basename = g_strconcat(prefix ? prefix : "", tap, extension, NULL);
+  gchar* path = g_build_filename(dir && *dir ? dir : "/tmp", basename, NULL);
+  g_free(basename);
+  return path;
+}
+
+// Parses an encoding name; returns FALSE if it isn't one.
+static inline gboolean dump_tmp_parse_encoding(const char* name, dump_tmp_encoding_t* encoding) {
+  if (!g_strcmp0(name, "float32")) *encoding = DUMP_TMP_FLOAT32;
+  else if (!g_strcmp0(name, "float16")) *encoding = DUMP_TMP_FLOAT16;
+  else if (!g_strcmp0(name, "uint16")) *encoding = DUMP_TMP_UINT16;
+  else return FALSE;
+  return TRUE;
+}
+
+// Sample encoding of a tap, from DT_TMP_ENCODING.
+//
+// DT_TMP_ENCODING is a comma-separated list of "float32", "float16" or
+// "uint16" (normalized to [0, 1] and clamped), optionally qualified by a tap
+// pattern, e.g. "float16,colorout_out=uint16". An unqualified entry sets the
+// default; the last matching qualified entry wins. Patterns match like
+// DT_TAP_SELECT's. Defaults to float32.
+static inline dump_tmp_encoding_t dump_tmp_tap_encoding(const char* tap) {
+  dump_tmp_encoding_t encoding = DUMP_TMP_FLOAT32;
+  const char* spec = g_getenv("DT_TMP_ENCODING");
+  if (!spec) return encoding;
+
+  gchar** entries = g_strsplit(spec, ",", -1);
+  for (gchar** e = entries; *e; e++) {
+    gchar** kv = g_strsplit(g_strstrip(*e), "=", 2);
+    if (kv[0] && kv[1]) {
+      gchar* prefix = g_strconcat(kv[0], "_*", NULL);
+      if (g_pattern_match_simple(kv[0], tap) || g_pattern_match_simple(prefix, tap))
+        dump_tmp_parse_encoding(kv[1], &encoding);
+      g_free(prefix);
+    } else if (kv[0] && *kv[0] && !dump_tmp_parse_encoding(kv[0], &encoding)) {
+      fprintf(stderr, "dump_tmp: unknown encoding `%s' in DT_TMP_ENCODING\n", kv[0]);
+    }
+    g_strfreev(kv);
+  }
+  g_strfreev(entries);
+  return encoding;
+}
+
+// Compression, from DT_TMP_COMPRESSION: unset or "none", "deflate" (zlib
+// level 1, which is about as fast as the disk), or "deflate:<level>" with
+// level 1-9. DT_TMP_BAND_ROWS sets the rows per compressed band (default 64).
+static inline void dump_tmp_parse_compression(dump_tmp_options_t* options) {
+  options->compression_level = 0;
+  options->band_rows = 64;
+
+  const char* compression = g_getenv("DT_TMP_COMPRESSION");
+  if (!compression || !*compression || !g_strcmp0(compression, "none")) return;
+  if (g_str_has_prefix(compression, "deflate")) {
+    const char* level = strchr(compression, ':');
+    options->compression_level = level ? CLAMP((int)g_ascii_strtoll(level + 1, NULL, 10), 1, 9) : 1;
+  } else {
+    fprintf(stderr, "dump_tmp: unknown DT_TMP_COMPRESSION `%s', writing uncompressed\n", compression);
+    return;
+  }
+
+  const char* band_rows = g_getenv("DT_TMP_BAND_ROWS");
+  if (band_rows) options->band_rows = MAX(1, (int)g_ascii_strtoll(band_rows, NULL, 10));
+}
+
+// Reduced taps, for datasets that only need crops or thumbnails:
+//   DT_TAP_CROP="x,y,width,height" crops each tap (in the tap buffer's pixels),
+//   DT_TAP_DOWNSAMPLE=<n> then shrinks it by an integer factor, with
+//   DT_TAP_DOWNSAMPLE_FILTER="box" (the default, the mean of each n x n block)
+//   or "bilinear" (a tent over the 2n x 2n block around it).
+static inline void dump_tmp_parse_reduction(dump_tmp_options_t* options) {
+  options->crop_x = options->crop_y = options->crop_width = options->crop_height = 0;
+  options->downsample = 1;
+  options->filter = DUMP_TMP_BOX;
+
+  const char* crop = g_getenv("DT_TAP_CROP");
+  if (crop && *crop) {
+    if (sscanf(crop, "%d,%d,%d,%d", &options->crop_x, &options->crop_y, &options->crop_width,
+               &options->crop_height) != 4) {
+      fprintf(stderr, "dump_tmp: DT_TAP_CROP must be `x,y,width,height', got `%s'\n", crop);
+      options->crop_width = options->crop_height = 0;
+    }
+  }
+
+  const char* downsample = g_getenv("DT_TAP_DOWNSAMPLE");
+  if (downsample) options->downsample = MAX(1, (int)g_ascii_strtoll(downsample, NULL, 10));
+
+  const char* filter = g_getenv("DT_TAP_DOWNSAMPLE_FILTER");
+  if (filter && !g_strcmp0(filter, "bilinear")) options->filter = DUMP_TMP_BILINEAR;
+}
+
+// Applies the crop and downsampling of `options` to a tap. Returns a new
+// buffer (free with dt_free_align) described by *reduced_roi, or NULL when
+// the tap is written at full size.
+//
+// Single-channel taps are raw CFA mosaics: those are cropped on even
+// coordinates and downsampled by averaging same-color samples only, which
+// keeps the 2x2 Bayer pattern intact (bilinear falls back to box). X-Trans
+// mosaics are not handled.
+static inline float* dump_tmp_reduce(const float* buffer, const dt_iop_roi_t* roi, int channels,
+                                     const dump_tmp_options_t* options, dt_iop_roi_t* reduced_roi) {
+  const int f = options->downsample;
+  const gboolean crop = options->crop_width > 0 && options->crop_height > 0;
+  if (f <= 1 && !crop) return NULL;
+
+  const gboolean mosaic = channels == 1;
+  const int align = mosaic ? 2 : 1;
+
+  int x0 = 0, y0 = 0, w = roi->width, h = roi->height;
+  if (crop) {
+    x0 = CLAMP(options->crop_x, 0, roi->width) / align * align;
+    y0 = CLAMP(options->crop_y, 0, roi->height) / align * align;
+    w = MIN(options->crop_width, roi->width - x0);
+    h = MIN(options->crop_height, roi->height - y0);
+  }
+  if (w < f * align || h < f * align) {
+    fprintf(stderr, "dump_tmp: crop/downsample leaves no pixels, writing the full tap\n");
+    return NULL;
+  }
+
+  const int out_w = w / (f * align) * align;
+  const int out_h = h / (f * align) * align;
+  float* out = dt_alloc_align_float((size_t)out_w * out_h * channels);
+  if (!out) return NULL;
+
+  const float* in = buffer + ((size_t)y0 * roi->width + x0) * channels;
+  const size_t stride = (size_t)roi->width * channels;
+  const gboolean bilinear = options->filter == DUMP_TMP_BILINEAR && !mosaic;
+  const float norm = 1.0f / (f * f);
+
+#ifdef _OPENMP
+#pragma omp parallel for default(none) \
+  dt_omp_firstprivate(in, out, stride, channels, f, w, h, out_w, out_h, mosaic, bilinear, norm) \
+  schedule(static)
+#endif
+  for (int y = 0; y < out_h; y++) {
+    float* row = out + (size_t)y * out_w * channels;
+    if (mosaic) {
+      // Output pixel (x, y) averages the f x f same-color samples of CFA cells
+      // [X * f, X * f + f) x [Y * f, Y * f + f), X = x / 2, Y = y / 2.
+      const int py = y & 1, Y = y >> 1;
+      for (int x = 0; x < out_w; x++) {
+        const int px = x & 1, X = x >> 1;
+        float sum = 0.0f;
+        for (int j = 0; j < f; j++)
+          for (int i = 0; i < f; i++) sum += in[(size_t)(2 * (Y * f + j) + py) * stride + 2 * (X * f + i) + px];
+        row[x] = sum * norm;
+      }
+    } else if (bilinear) {
+      // The tent filter that bilinear interpolation is, stretched by f: every
+      // input pixel within one output pixel of the output pixel's center
+      // counts, weighted by 1 - distance / f. Unlike sampling the 4 nearest
+      // inputs, this averages the whole footprint, so it doesn't alias.
+      const float cy = (y + 0.5f) * f;
+      const int j0 = MAX(0, y * f - f), j1 = MIN(h, y * f + 2 * f);
+      for (int x = 0; x < out_w; x++) {
+        const float cx = (x + 0.5f) * f;
+        const int i0 = MAX(0, x * f - f), i1 = MIN(w, x * f + 2 * f);
+        float* o = row + (size_t)x * channels;
+        for (int c = 0; c < channels; c++) o[c] = 0.0f;
+        float total = 0.0f;
+        for (int j = j0; j < j1; j++) {
+          const float wy = 1.0f - fabsf(j + 0.5f - cy) / f;
+          if (wy <= 0.0f) continue;
+          for (int i = i0; i < i1; i++) {
+            const float wx = 1.0f - fabsf(i + 0.5f - cx) / f;
+            if (wx <= 0.0f) continue;
+            const float* p = in + (size_t)j * stride + (size_t)i * channels;
+            for (int c = 0; c < channels; c++) o[c] += wx * wy * p[c];
+            total += wx * wy;
+          }
+        }
+        // Near the edges the tent is cut off: renormalize what is left.
+        for (int c = 0; c < channels; c++) o[c] /= total;
+      }
+    } else {
+      for (int x = 0; x < out_w; x++) {
+        for (int c = 0; c < channels; c++) {
+          float sum = 0.0f;
+          for (int j = 0; j < f; j++)
+            for (int i = 0; i < f; i++) sum += in[(size_t)(y * f + j) * stride + (size_t)(x * f + i) * channels + c];
+          row[(size_t)x * channels + c] = sum * norm;
+        }
+      }
+    }
+  }
+
+  reduced_roi->x = (roi->x + x0) / f;
+  reduced_roi->y = (roi->y + y0) / f;
+  reduced_roi->width = out_w;
+  reduced_roi->height = out_h;
+  reduced_roi->scale = roi->scale / f;
+  return out;
+}
+
+// DT_TAP_FORMAT: "tmp" (the default), "tiff", which writes <prefix><tap>.tif
+// directly instead of a TMP file to be converted later, or "stats", which
+// writes <prefix><tap>.json with the statistics of dump_tmp_stats() instead of
+// the samples. DT_TAP_STATS_BINS sets the histogram bins (default 256).
+static inline const char* dump_tmp_extension(const dump_tmp_format_t format) {
+  if (format == DUMP_TMP_FORMAT_TIFF) return ".tif";
+  if (format == DUMP_TMP_FORMAT_STATS) return ".json";
+  return ".tmp";
+}
+
+static inline dump_tmp_options_t dump_tmp_tap_options(const char* tap) {
+  dump_tmp_options_t options;
+  const char* format = g_getenv("DT_TAP_FORMAT");
+  options.format = DUMP_TMP_FORMAT_TMP;
+  if (format && (!g_strcmp0(format, "tiff") || !g_strcmp0(format, "tif"))) options.format = DUMP_TMP_FORMAT_TIFF;
+  if (format && !g_strcmp0(format, "stats")) options.format = DUMP_TMP_FORMAT_STATS;
+  const char* bins = g_getenv("DT_TAP_STATS_BINS");
+  options.stats_bins = bins ? CLAMP((int)g_ascii_strtoll(bins, NULL, 10), 1, 4096) : 256;
+  const char* layout = g_getenv("DT_TMP_LAYOUT");
+  options.layout = layout && !g_strcmp0(layout, "interleaved") ? DUMP_TMP_INTERLEAVED : DUMP_TMP_PLANAR;
+  options.encoding = dump_tmp_tap_encoding(tap);
+  dump_tmp_parse_compression(&options);
+  dump_tmp_parse_reduction(&options);
+  options.atomic = FALSE;
+  return options;
+}
+
+static inline void dump_tmp_write(const float* buffer, const dt_iop_roi_t* roi, int channels,
+                                  const dump_tmp_options_t* options, const char* filename) {
+  if (options->atomic) {
+    // Readers (and other processes storing the same object) only ever see
+    // complete files.
+    gchar* part = g_strdup_printf("%s.part-%d-%" G_GUINT64_FORMAT, filename, (int)getpid(),
+                                  (guint64)(uintptr_t)g_thread_self());
+    dump_tmp_options_t direct = *options;
+    direct.atomic = FALSE;
+    dump_tmp_write(buffer, roi, channels, &direct, part);
+    if (g_rename(part, filename)) {
+      fprintf(stderr, "dump_tmp: could not rename %s to %s\n", part, filename);
+      g_unlink(part);
+    }
+    g_free(part);
+    return;
+  }
+  if (options->format == DUMP_TMP_FORMAT_STATS) {
+    dump_tmp_stats(buffer, roi, channels, options, filename);
+  } else if (options->format == DUMP_TMP_FORMAT_TIFF) {
+    dump_tmp_tiff(buffer, roi, channels, options, filename);
+  } else if (options->compression_level > 0) {
+    dump_tmp_compressed(buffer, roi, channels, options, filename);
+  } else if (options->layout == DUMP_TMP_INTERLEAVED) {
+    dump_tmp_interleaved(buffer, roi, channels, options, filename);
+  } else {
+    dump_tmp_planar(buffer, roi, channels, options, filename);
+  }
+}
+
+// Per-render trace.
+//
+// With DT_TAP_TRACE=<path>, every process() of a tapped module, its main
+// OpenMP regions and every tap write append one JSON object per line to
+// <path>:
+//   {"cat":"process","name":"sharpen","pid":..,"tid":..,"ts_us":..,"wall_us":..,
+//    "process_cpu_us":..,"threads":..,"heap_delta":..,"bytes":..}
+// cat is "process", "omp" (name is "<module>.<region>"), "tap" (the time
+// dump_tmp() holds up process(), including the crop/downsample and, when
+// writing synchronously, the encode and write) or "tap_write" (the write on
+// the DT_TAP_ASYNC writer thread). ts_us is g_get_monotonic_time() at the
+// start. process_cpu_us is the CPU time the whole process used meanwhile: it
+// sums over the OpenMP team, and over whatever else runs concurrently, e.g.
+// the tap writer. heap_delta is the change of malloc'ed bytes in use (glibc
+// only, otherwise 0); bytes is the size of the module's input plus output
+// buffers, or of the tap. Spans nest: a process span includes its taps and
+// regions.
+//
+// Every plugin that includes this header keeps the trace open, in append
+// mode, from its first event until DT_TAP_TRACE changes or the plugin is
+// unloaded. Each line goes out in one write(), so lines from the plugins,
+// from the driver and from concurrent renders stay whole in a shared trace.
+typedef struct dump_tmp_span_t {
+  const char* cat;  // NULL: tracing is off.
+  const char* name;
+  gint64 wall_start;
+  gint64 cpu_start;
+  int64_t heap_start;
+  size_t bytes;
+} dump_tmp_span_t;
+
+static inline gint64 dump_tmp_cpu_us(void) {
+  struct timespec ts;
+  if (clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts)) return 0;
+  return (gint64)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static inline int64_t dump_tmp_heap_bytes(void) {
+#if defined(__GLIBC__)
+#if __GLIBC_PREREQ(2, 33)
+  const struct mallinfo2 mi = mallinfo2();
+  return (int64_t)(mi.uordblks + mi.hblkhd);
+#else
+  // mallinfo2() is new in glibc 2.33 (Ubuntu 20.04 has 2.31). mallinfo()'s
+  // fields are ints, so read them as unsigned: they are right up to 4 GiB.
+  const struct mallinfo mi = mallinfo();
+  return (int64_t)(unsigned int)mi.uordblks + (unsigned int)mi.hblkhd;
+#endif
+#else
+  return 0;
+#endif
+}
+
+static GMutex dump_tmp_trace_lock;
+static FILE* dump_tmp_trace_file = NULL;
+static gchar* dump_tmp_trace_path = NULL;
+
+// Appends `line` to the trace at `path`, (re)opening it if DT_TAP_TRACE
+// changed since the last event.
+static inline void dump_tmp_trace_write(const char* path, const char* line) {
+  g_mutex_lock(&dump_tmp_trace_lock);
+  if (g_strcmp0(path, dump_tmp_trace_path)) {
+    if (dump_tmp_trace_file) fclose(dump_tmp_trace_file);
+    g_free(dump_tmp_trace_path);
+    dump_tmp_trace_path = g_strdup(path);
+    dump_tmp_trace_file = g_fopen(path, "a");
+    if (!dump_tmp_trace_file) fprintf(stderr, "dump_tmp: could not open trace %s\n", path);
+  }
+  // The line fits the stream's buffer, so the fflush() is a single write().
+  if (dump_tmp_trace_file && (fputs(line, dump_tmp_trace_file) < 0 || fflush(dump_tmp_trace_file))) {
+    fprintf(stderr, "dump_tmp: could not write to trace %s\n", path);
+  }
+  g_mutex_unlock(&dump_tmp_trace_lock);
+}
+
+__attribute__((destructor)) static void dump_tmp_trace_close(void) {
+  if (dump_tmp_trace_file) fclose(dump_tmp_trace_file);
+  dump_tmp_trace_file = NULL;
+  g_free(dump_tmp_trace_path);
+  dump_tmp_trace_path = NULL;
+}
+
+static inline dump_tmp_span_t dump_tmp_span_begin(const char* cat, const char* name) {
+  dump_tmp_span_t span = { 0 };
+  const char* trace = g_getenv("DT_TAP_TRACE");
+  if (!trace || !*trace) return span;
+  span.cat = cat;
+  span.name = name;
+  span.heap_start = dump_tmp_heap_bytes();
+  span.cpu_start = dump_tmp_cpu_us();
+  span.wall_start = g_get_monotonic_time();
+  return span;
+}
+
+static inline void dump_tmp_span_end(const dump_tmp_span_t* span) {
+  if (!span->cat) return;
+  const gint64 wall_end = g_get_monotonic_time();
+  const gint64 cpu_end = dump_tmp_cpu_us();
+  const int64_t heap_end = dump_tmp_heap_bytes();
+  const char* trace = g_getenv("DT_TAP_TRACE");
+  if (!trace || !*trace) return;
+
+#ifdef _OPENMP
+  const int threads = omp_get_max_threads();
+#else
+  const int threads = 1;
+#endif
+  gchar* line = g_strdup_printf("{\"cat\":\"%s\",\"name\":\"%s\",\"pid\":%d,\"tid\":%" G_GUINT64_FORMAT
+                                ",\"ts_us\":%" G_GINT64_FORMAT ",\"wall_us\":%" G_GINT64_FORMAT
+                                ",\"process_cpu_us\":%" G_GINT64_FORMAT ",\"threads\":%d,\"heap_delta\":%" G_GINT64_FORMAT
+                                ",\"bytes\":%" G_GUINT64_FORMAT "}\n",
+                                span->cat, span->name, (int)getpid(), (guint64)(uintptr_t)g_thread_self(),
+                                span->wall_start, wall_end - span->wall_start, cpu_end - span->cpu_start, threads,
+                                (gint64)(heap_end - span->heap_start), (guint64)span->bytes);
+  dump_tmp_trace_write(trace, line);
+  g_free(line);
+}
+
+// Ends a module's process() span, recording the sizes of its buffers.
+static inline void dump_tmp_process_end(dump_tmp_span_t* span, const dt_iop_roi_t* roi_in,
+                                        const dt_iop_roi_t* roi_out, int channels) {
+  span->bytes = ((size_t)roi_in->width * roi_in->height + (size_t)roi_out->width * roi_out->height)
+                * channels * sizeof(float);
+  dump_tmp_span_end(span);
+}
+
+// Asynchronous tap-out.
+//
+// With DT_TAP_ASYNC=1, dump_tmp() copies the buffer and hands it to a writer
+// thread, so process() returns while the file is written and the next module
+// computes. Copies in flight are capped at DT_TAP_ASYNC_MB megabytes (default
+// 2048); when the cap is hit, dump_tmp() blocks until the writer catches up.
+//
+// Every plugin that includes this header gets its own writer. Pending writes
+// are flushed by a destructor when the plugin is unloaded or the process exits.
+typedef struct dump_tmp_job_t {
+  float* buffer;
+  dt_iop_roi_t roi;
+  int channels;
+  dump_tmp_options_t options;
+  gchar* filename;
+  gchar* tap;
+  size_t size;
+} dump_tmp_job_t;
+
+static GThreadPool* dump_tmp_pool = NULL;
+static GMutex dump_tmp_pending_lock;
+static GCond dump_tmp_pending_cond;
+static size_t dump_tmp_pending_bytes = 0;
+static size_t dump_tmp_pending_limit = 0;
+
+static void dump_tmp_async_worker(gpointer data, gpointer user_data) {
+  dump_tmp_job_t* job = (dump_tmp_job_t*)data;
+#ifdef _OPENMP
+  // Don't compete with the pixelpipe's own OpenMP team.
+  omp_set_num_threads(1);
+#endif
+  dump_tmp_span_t span = dump_tmp_span_begin("tap_write", job->tap);
+  span.bytes = job->size;
+  dump_tmp_write(job->buffer, &job->roi, job->channels, &job->options, job->filename);
+  dump_tmp_span_end(&span);
+
+  g_mutex_lock(&dump_tmp_pending_lock);
+  dump_tmp_pending_bytes -= job->size;
+  g_cond_broadcast(&dump_tmp_pending_cond);
+  g_mutex_unlock(&dump_tmp_pending_lock);
+
+  dt_free_align(job->buffer);
+  g_free(job->filename);
+  g_free(job->tap);
+  g_free(job);
+}
+
+// Returns the writer pool, or NULL when DT_TAP_ASYNC is not enabled.
+static inline GThreadPool* dump_tmp_async_pool(void) {
+  static gsize initialized = 0;
+  if (g_once_init_enter(&initialized)) {
+    const char* async = g_getenv("DT_TAP_ASYNC");
+    if (async && *async && g_strcmp0(async, "0")) {
+      const char* limit_mb = g_getenv("DT_TAP_ASYNC_MB");
+      const gint64 mb = limit_mb ? g_ascii_strtoll(limit_mb, NULL, 10) : 0;
+      dump_tmp_pending_limit = (size_t)(mb > 0 ? mb : 2048) << 20;
+      // A single writer keeps the disk streaming sequentially.
+      dump_tmp_pool = g_thread_pool_new(dump_tmp_async_worker, NULL, 1, FALSE, NULL);
+    }
+    g_once_init_leave(&initialized, 1);
+  }
+  return dump_tmp_pool;
+}
+
+// Blocks until every tap queued so far has been written. Exported from each
+// plugin so that drivers can look it up with g_module_symbol() and make sure a
+// render's taps are complete before reporting it done.
+__attribute__((visibility("default"))) void dump_tmp_flush(void) {
+  g_mutex_lock(&dump_tmp_pending_lock);
+  while (dump_tmp_pending_bytes > 0) {
+    g_cond_wait(&dump_tmp_pending_cond, &dump_tmp_pending_lock);
+  }
+  g_mutex_unlock(&dump_tmp_pending_lock);
+}
+
+__attribute__((destructor)) static void dump_tmp_async_flush(void) {
+  if (dump_tmp_pool) {
+    // Waits for every queued tap to be written.
+    g_thread_pool_free(dump_tmp_pool, FALSE, TRUE);
+    dump_tmp_pool = NULL;
+  }
+}
+
+// Queues a tap. Takes ownership of filename, and of `owned` if it is not NULL:
+// that is then written instead of a copy of `buffer`.
+static inline void dump_tmp_async(GThreadPool* pool, const float* buffer, float* owned, const dt_iop_roi_t* roi,
+                                  int channels, const dump_tmp_options_t* options, gchar* filename,
+                                  const char* tap) {
+  const size_t nfloats = (size_t)roi->width * roi->height * channels;
+  const size_t size = nfloats * sizeof(float);
+
+  g_mutex_lock(&dump_tmp_pending_lock);
+  // Always admit at least one job, however large, so we can't deadlock.
+  while (dump_tmp_pending_bytes > 0 && dump_tmp_pending_bytes + size > dump_tmp_pending_limit) {
+    g_cond_wait(&dump_tmp_pending_cond, &dump_tmp_pending_lock);
+  }
+  dump_tmp_pending_bytes += size;
+  g_mutex_unlock(&dump_tmp_pending_lock);
+
+  float* copy = owned ? owned : dt_alloc_align_float(nfloats);
+  if (!copy) {
+    // Fall back to writing synchronously.
+    g_mutex_lock(&dump_tmp_pending_lock);
+    dump_tmp_pending_bytes -= size;
+    g_cond_broadcast(&dump_tmp_pending_cond);
+    g_mutex_unlock(&dump_tmp_pending_lock);
+    dump_tmp_write(buffer, roi, channels, options, filename);
+    g_free(filename);
+    return;
+  }
+  if (!owned) memcpy(copy, buffer, size);
+
+  dump_tmp_job_t* job = g_new(dump_tmp_job_t, 1);
+  job->buffer = copy;
+  job->roi = *roi;
+  job->channels = channels;
+  job->options = *options;
+  job->filename = filename;
+  job->tap = g_strdup(tap);
+  job->size = size;
+  g_thread_pool_push(pool, job, NULL);
+}
+
+// Content-addressed tap store.
+//
+// With DT_TAP_STORE=<dir>, a tap is written once per distinct content to
+// <dir>/<hh>/<sha256><extension>, where <sha256> hashes the tap's samples
+// (after crop and downsampling), its dimensions and every option that changes
+// the file (format, layout, encoding, compression). The usual tap path
+// becomes a symlink to that object, so readers are unchanged, and
+// py/tap_store.py turns the symlinks of a render into its manifest.
+//
+// The key is computed before anything is encoded: a tap whose object already
+// exists, e.g. the upstream stages of every render in a sweep but the first,
+// costs one hash of the buffer and no write. Hashing runs in parallel over
+// 4 MB bands, and the key is the SHA-256 of the options and the band digests.
+#define DUMP_TMP_STORE_BAND_BYTES ((size_t)4 << 20)
+
+// Returns the store object for a tap. Free with g_free().
+static inline gchar* dump_tmp_store_object(const char* store, const float* buffer, const dt_iop_roi_t* roi,
+                                           int channels, const dump_tmp_options_t* options,
+                                           const char* extension) {
+  const size_t size = (size_t)roi->width * roi->height * channels * sizeof(float);
+  const size_t num_bands = MAX((size_t)1, (size_t)((size + DUMP_TMP_STORE_BAND_BYTES - 1) / DUMP_TMP_STORE_BAND_BYTES));
+  guint8* digests = g_malloc(num_bands * 32);
+  const guint8* bytes = (const guint8*)buffer;
+
+#ifdef _OPENMP
+#pragma omp parallel for default(none) dt_omp_firstprivate(bytes, size, num_bands, digests) schedule(static)
+#endif
+  for (size_t b = 0; b < num_bands; b++) {
+    const size_t start = b * DUMP_TMP_STORE_BAND_BYTES;
+    GChecksum* band = g_checksum_new(G_CHECKSUM_SHA256);
+    g_checksum_update(band, bytes + start, MIN(DUMP_TMP_STORE_BAND_BYTES, size - start));
+    gsize len = 32;
+    g_checksum_get_digest(band, digests + 32 * b, &len);
+    g_checksum_free(band);
+  }
+
+  // Options that don't change the file (crop, downsampling) are already
+  // reflected in the samples; band_rows only matters when compressing.
+  gchar* header = g_strdup_printf("dump_tmp 1 %d %d %d format=%d layout=%d encoding=%d compression=%d band_rows=%d",
+                                  roi->width, roi->height, channels, options->format, options->layout,
+                                  options->encoding, options->compression_level,
+                                  options->compression_level > 0 ? options->band_rows : 0);
+  GChecksum* key = g_checksum_new(G_CHECKSUM_SHA256);
+  g_checksum_update(key, (const guchar*)header, strlen(header) + 1);
+  g_checksum_update(key, digests, num_bands * 32);
+  const gchar* hex = g_checksum_get_string(key);
+
+  gchar* subdir = g_strndup(hex, 2);
+  gchar* dir = g_build_filename(store, subdir, NULL);
+  g_mkdir_with_parents(dir, 0755);
+  gchar* basename = g_strconcat(hex, extension, NULL);
+  gchar* object = g_build_filename(dir, basename, NULL);
+
+  g_free(basename);
+  g_free(dir);
+  g_free(subdir);
+  g_checksum_free(key);
+  g_free(header);
+  g_free(digests);
+  return object;
+}
+
+// Points the tap path `link` at `object`, replacing whatever was there. A
+// relative DT_TAP_STORE is relative to the current directory, not to the
+// link's, so the link gets the object's absolute path.
+static inline void dump_tmp_store_link(const char* object, const char* link) {
+  gchar* target = NULL;
+  if (!g_path_is_absolute(object)) {
+    gchar* cwd = g_get_current_dir();
+    target = g_build_filename(cwd, object, NULL);
+    g_free(cwd);
+  }
+  gchar* part = g_strdup_printf("%s.part-%d", link, (int)getpid());
+  g_unlink(part);
+  if (symlink(target ? target : object, part) || g_rename(part, link)) {
+    fprintf(stderr, "dump_tmp: could not link %s to %s\n", link, object);
+    g_unlink(part);
+  }
+  g_free(part);
+  g_free(target);
+}
+
+// Writes the tap named `tap` in the layout selected by the DT_TMP_LAYOUT
+// environment variable: "interleaved", or "planar" (the default, plain
+// ImageStack TMP), and the encoding selected by DT_TMP_ENCODING. Taps not
+// selected by DT_TAP_SELECT return immediately.
+static inline void dump_tmp(const float* buffer, const dt_iop_roi_t* roi, int channels, const char* tap) {
+  if (!dump_tmp_selected(tap)) return;
+
+  dump_tmp_span_t span = dump_tmp_span_begin("tap", tap);
+  span.bytes = (size_t)roi->width * roi->height * channels * sizeof(float);
+  dump_tmp_options_t options = dump_tmp_tap_options(tap);
+  gchar* filename = dump_tmp_path(tap, dump_tmp_extension(options.format));
+
+  dt_iop_roi_t reduced_roi;
+  float* reduced = dump_tmp_reduce(buffer, roi, channels, &options, &reduced_roi);
+  if (reduced) {
+    buffer = reduced;
+    roi = &reduced_roi;
+  }
+
+  // Statistics are small and computed in parallel right here: they are
+  // neither stored nor queued.
+  const gboolean stats = options.format == DUMP_TMP_FORMAT_STATS;
+  const char* store = g_getenv("DT_TAP_STORE");
+  if (store && *store && !stats) {
+    gchar* object = dump_tmp_store_object(store, buffer, roi, channels, &options,
+                                          dump_tmp_extension(options.format));
+    dump_tmp_store_link(object, filename);
+    g_free(filename);
+    filename = object;
+    if (g_file_test(object, G_FILE_TEST_EXISTS)) {
+      // Stored before, by this render or an earlier one.
+      if (reduced) dt_free_align(reduced);
+      g_free(filename);
+      dump_tmp_span_end(&span);
+      return;
+    }
+    options.atomic = TRUE;
+  }
+
+  GThreadPool* pool = stats ? NULL : dump_tmp_async_pool();
+  if (pool) {
+    // Takes ownership of filename and the reduced buffer.
+    dump_tmp_async(pool, buffer, reduced, roi, channels, &options, filename, tap);
+    dump_tmp_span_end(&span);
+    return;
+  }
+  dump_tmp_write(buffer, roi, channels, &options, filename);
+  if (reduced) dt_free_align(reduced);
+  g_free(filename);
+  dump_tmp_span_end(&span);
+}
+
+static inline void debug_print_roi(const dt_iop_roi_t *const roi) {
   fprintf(stderr, "roi x = %d, y = %d, width = %d, height = %d, scale = %f\n",
     roi->x, roi->y, roi->width, roi->height, roi->scale);
 }
 
-inline void debug_print_color_matrix(const dt_colormatrix_t m) {
+static inline void debug_print_color_matrix(const dt_colormatrix_t m) {
   // Apparently, they store things transposed... I think.
   // See dt_colormatrix_mul in dttypes.h.
   for (int i = 0; i < 4; ++i) {
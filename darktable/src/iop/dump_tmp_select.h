@@ -0,0 +1,64 @@
+#pragma once
+
+#include <glib.h>
+
+// Tap selection, shared by the tapped iops (through iop/dump_tmp.h) and the
+// drivers that need to know which taps a render writes (cli/render_server.c).
+//
+// DT_TAP_SELECT is a comma-separated list of glob patterns naming the taps to
+// write, e.g. "colorbalancergb" (both sides), "sharpen_out" or "*_in". A
+// pattern also matches every tap it is a "<pattern>_" prefix of. Unset means
+// every tap; "none" or an empty string means no tap at all.
+static inline gboolean dump_tmp_selected(const char* tap) {
+  // Re-read on every call: a long-lived driver (cli/render_server.c) changes
+  // the selection between renders, and a handful of taps per render makes the
+  // parsing cost irrelevant.
+  const char* select = g_getenv("DT_TAP_SELECT");
+  if (!select) return TRUE;
+
+  gboolean match = FALSE;
+  gchar** patterns = g_strsplit(select, ",", -1);
+  for (gchar** p = patterns; *p && !match; p++) {
+    g_strstrip(*p);
+    if (!**p || !g_strcmp0(*p, "none")) continue;
+    gchar* prefix = g_strconcat(*p, "_*", NULL);
+    match = g_pattern_match_simple(*p, tap) || g_pattern_match_simple(prefix, tap);
+    g_free(prefix);
+  }
+  g_strfreev(patterns);
+  return match;
+}
+
+// Whether any tap the iop `op` writes is selected. This is the list of the
+// dump_tmp() calls in the tapped iops, keep it in sync with them; sharpen also
+// writes sharpen_out_<k> for every DT_TAP_SHARPEN_SWEEP pair.
+static inline gboolean dump_tmp_module_selected(const char* op) {
+  static const char* const taps[][3] = {
+    { "temperature", "temperature_bayer_in", "temperature_bayer_out" },
+    { "highlights", "highlights_bayer_in", "highlights_bayer_out" },
+    { "exposure", "exposure_in", "exposure_out" },
+    { "colorin", "colorin_in", "colorin_out" },
+    { "sharpen", "sharpen_in", "sharpen_out" },
+    { "colorbalancergb", "colorbalancergb_in", "colorbalancergb_out" },
+    { "filmicrgb", "filmicrgb_in", "filmicrgb_out" },
+    { "colorout", "colorout_in", "colorout_out" },
+  };
+  for (size_t k = 0; k < G_N_ELEMENTS(taps); k++) {
+    if (g_strcmp0(taps[k][0], op)) continue;
+    if (dump_tmp_selected(taps[k][1]) || dump_tmp_selected(taps[k][2])) return TRUE;
+    if (g_strcmp0(op, "sharpen")) return FALSE;
+
+    const char* sweep = g_getenv("DT_TAP_SHARPEN_SWEEP");
+    if (!sweep || !*sweep) return FALSE;
+    gboolean selected = FALSE;
+    gchar** pairs = g_strsplit(sweep, ",", -1);
+    for (int pair = 0; pairs[pair] && !selected; pair++) {
+      gchar* tap = g_strdup_printf("sharpen_out_%d", pair);
+      selected = dump_tmp_selected(tap);
+      g_free(tap);
+    }
+    g_strfreev(pairs);
+    return selected;
+  }
+  return FALSE;
+}
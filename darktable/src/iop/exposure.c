@@ -445,9 +445,11 @@ error:
 }
 #endif
 
+__DT_CLONE_TARGETS__
 void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const void *const i, void *const o,
              const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out)
 {
+  dump_tmp_span_t span = dump_tmp_span_begin("process", "exposure");
   const dt_iop_exposure_data_t *const d = (const dt_iop_exposure_data_t *const)piece->data;
 
   process_common_setup(self, piece);
@@ -459,6 +461,7 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
   const float black = d->black;
   const float scale = d->scale;
   const size_t npixels = (size_t)roi_out->width * roi_out->height;
+  dump_tmp_span_t scale_span = dump_tmp_span_begin("omp", "exposure.scale");
 #ifdef _OPENMP
 #pragma omp parallel for simd default(none) \
   dt_omp_firstprivate(ch, npixels, black, scale, in, out)  \
@@ -468,14 +471,15 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
   {
     out[k] = (in[k] - black) * scale;
   }
+  dump_tmp_span_end(&scale_span);
 
   if(piece->pipe->mask_display & DT_DEV_PIXELPIPE_DISPLAY_MASK) dt_iop_alpha_copy(i, o, roi_out->width, roi_out->height);
 
   for(int k = 0; k < 3; k++) piece->pipe->dsc.processed_maximum[k] *= d->scale;
 
-  // TODO(jiawen): get directory with getenv() to enable parallelism.
-  dump_tmp(in, roi_in, ch, "/tmp/exposure_in.tmp");
-  dump_tmp(out, roi_out, ch, "/tmp/exposure_out.tmp");
+  dump_tmp(in, roi_in, ch, "exposure_in");
+  dump_tmp(out, roi_out, ch, "exposure_out");
+  dump_tmp_process_end(&span, roi_in, roi_out, ch);
 }
 
 
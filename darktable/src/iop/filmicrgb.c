@@ -1583,6 +1583,7 @@ void process(dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const void *c
   }
 
   const size_t ch = 4;
+  dump_tmp_span_t span = dump_tmp_span_begin("process", "filmicrgb");
 
   /** The log2(x) -> -INF when x -> 0
    * thus very low values (noise) will get even lower, resulting in noise negative amplification,
@@ -1594,7 +1595,7 @@ void process(dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const void *c
    */
 
   float *restrict in = (float *)ivoid;
-  dump_tmp(in, roi_in, ch, "/tmp/filmicrgb_in.tmp");
+  dump_tmp(in, roi_in, ch, "filmicrgb_in");
 
   float *const restrict out = (float *)ovoid;
   float *const restrict mask = dt_alloc_sse_ps((size_t)roi_out->width * roi_out->height);
@@ -1603,7 +1604,9 @@ void process(dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const void *c
   const float scale = fmaxf(piece->iscale / roi_in->scale, 1.f);
 
   // build a mask of clipped pixels
+  dump_tmp_span_t mask_span = dump_tmp_span_begin("omp", "filmicrgb.mask");
   const int recover_highlights = mask_clipped_pixels(in, mask, data->normalize, data->reconstruct_feather, roi_out->width, roi_out->height, 4);
+  dump_tmp_span_end(&mask_span);
 
   // display mask and exit
   if(self->dev->gui_attached && (piece->pipe->type & DT_DEV_PIXELPIPE_FULL) == DT_DEV_PIXELPIPE_FULL && mask)
@@ -1624,6 +1627,7 @@ void process(dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const void *c
   // if fast mode is not in use
   if(!run_fast && recover_highlights && mask && reconstructed)
   {
+    dump_tmp_span_t reconstruct_span = dump_tmp_span_begin("omp", "filmicrgb.reconstruct");
     // init the blown areas with noise to create particles
     float *const restrict inpainted =  dt_alloc_align_float((size_t)roi_out->width * roi_out->height * 4);
     inpaint_noise(in, mask, inpainted, data->noise_level / scale, data->reconstruct_threshold, data->noise_distribution,
@@ -1660,10 +1664,12 @@ void process(dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const void *c
     }
 
     if(success_1 && success_2) in = reconstructed; // use reconstructed buffer as tonemapping input
+    dump_tmp_span_end(&reconstruct_span);
   }
 
   if(mask) dt_free_align(mask);
 
+  dump_tmp_span_t curve_span = dump_tmp_span_begin("omp", "filmicrgb.curve");
   if(data->preserve_color == DT_FILMIC_METHOD_NONE)
   {
     // no chroma preservation
@@ -1682,13 +1688,15 @@ void process(dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const void *c
       filmic_chroma_v2_v3(in, out, work_profile, data, data->spline, data->preserve_color, roi_out->width,
                           roi_out->height, ch, data->version);
   }
+  dump_tmp_span_end(&curve_span);
 
   if(reconstructed) dt_free_align(reconstructed);
 
   if(piece->pipe->mask_display & DT_DEV_PIXELPIPE_DISPLAY_MASK)
     dt_iop_alpha_copy(ivoid, ovoid, roi_out->width, roi_out->height);
 
-  dump_tmp(out, roi_out, ch, "/tmp/filmicrgb_out.tmp");
+  dump_tmp(out, roi_out, ch, "filmicrgb_out");
+  dump_tmp_process_end(&span, roi_in, roi_out, ch);
 }
 
 #ifdef HAVE_OPENCL
@@ -768,6 +768,7 @@ static void process_lch_xtrans(dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *pi
 #undef SQRT3
 #undef SQRT12
 
+__DT_CLONE_TARGETS__
 static void process_clip(dt_dev_pixelpipe_iop_t *piece, const void *const ivoid, void *const ovoid,
                          const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out,
                          const float clip)
@@ -775,6 +776,7 @@ static void process_clip(dt_dev_pixelpipe_iop_t *piece, const void *const ivoid,
   const float *const in = (const float *const)ivoid;
   float *const out = (float *const)ovoid;
 
+  dump_tmp_span_t span = dump_tmp_span_begin("omp", "highlights.clip");
   if(piece->pipe->dsc.filters)
   { // raw mosaic
 #ifdef _OPENMP
@@ -801,6 +803,7 @@ static void process_clip(dt_dev_pixelpipe_iop_t *piece, const void *const ivoid,
       out[k] = MIN(clip, in[k]);
     }
   }
+  dump_tmp_span_end(&span);
 }
 
 void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const void *const ivoid,
@@ -814,7 +817,8 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
                            fminf(piece->pipe->dsc.processed_maximum[1], piece->pipe->dsc.processed_maximum[2]));
   const int ch = piece->colors;
   fprintf(stderr, "ELEPHANT: [HIGHLIGHTS]. ch = %d, bpc = %d, filters = %d\n", ch, piece->bpc, filters);
-  dump_tmp((const float*)ivoid, roi_in, ch, "/tmp/highlights_bayer_in.tmp");
+  dump_tmp_span_t span = dump_tmp_span_begin("process", "highlights");
+  dump_tmp((const float*)ivoid, roi_in, ch, "highlights_bayer_in");
   if(!filters)
   {
     process_clip(piece, ivoid, ovoid, roi_in, roi_out, clip);
@@ -822,6 +826,7 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
       piece->pipe->dsc.processed_maximum[k]
           = fminf(piece->pipe->dsc.processed_maximum[0],
                   fminf(piece->pipe->dsc.processed_maximum[1], piece->pipe->dsc.processed_maximum[2]));
+    dump_tmp_process_end(&span, roi_in, roi_out, ch);
     return;
   }
 
@@ -834,6 +839,7 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
                                0.987 * data->clip * piece->pipe->dsc.processed_maximum[1],
                                0.987 * data->clip * piece->pipe->dsc.processed_maximum[2], clip };
 
+      dump_tmp_span_t inpaint_span = dump_tmp_span_begin("omp", "highlights.inpaint");
       if(filters == 9u)
       {
         fprintf(stderr, "ELEPHANT [HIGHLIGHTS] xtrans\n");
@@ -889,10 +895,13 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
           interpolate_color(ivoid, ovoid, roi_out, 1, -1, i, clips, filters, 3);
         }
       }
+      dump_tmp_span_end(&inpaint_span);
       break;
     }
     case DT_IOP_HIGHLIGHTS_LCH:
+    {
       fprintf(stderr, "ELEPHANT [HIGHLIGHTS] DT_IOP_HIGHLIGHTS_LCH\n");
+      dump_tmp_span_t lch_span = dump_tmp_span_begin("omp", "highlights.lch");
       if(filters == 9u) {
         fprintf(stderr, "ELEPHANT [HIGHLIGHTS] xtrans\n");
         process_lch_xtrans(self, piece, ivoid, ovoid, roi_in, roi_out, clip);
@@ -901,7 +910,9 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
         fprintf(stderr, "HIGHLIGHTS: [TEMPERATURE] Bayer float mosaiced.\n");
         process_lch_bayer(self, piece, ivoid, ovoid, roi_in, roi_out, clip);
       }
+      dump_tmp_span_end(&lch_span);
       break;
+    }
     default:
     case DT_IOP_HIGHLIGHTS_CLIP:
       fprintf(stderr, "ELEPHANT [HIGHLIGHTS] DT_IOP_HIGHLIGHTS_CLIP\n");
@@ -915,7 +926,8 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
   for(int k = 0; k < 3; k++) piece->pipe->dsc.processed_maximum[k] = m;
 
   if(piece->pipe->mask_display & DT_DEV_PIXELPIPE_DISPLAY_MASK) dt_iop_alpha_copy(ivoid, ovoid, roi_out->width, roi_out->height);
-  dump_tmp((const float*)ovoid, roi_out, ch, "/tmp/highlights_bayer_out.tmp");
+  dump_tmp((const float*)ovoid, roi_out, ch, "highlights_bayer_out");
+  dump_tmp_process_end(&span, roi_in, roi_out, ch);
 }
 
 void commit_params(struct dt_iop_module_t *self, dt_iop_params_t *p1, dt_dev_pixelpipe_t *pipe,
@@ -459,6 +459,7 @@ static inline void scaled_copy_4wide(float *const outp, const float *const inp,
     outp[c] = inp[c] * coeffs[c];
 }
 
+__DT_CLONE_TARGETS__
 void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const void *const ivoid,
              void *const ovoid, const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out)
 {
@@ -470,9 +471,11 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
   float *const out = (float *const)ovoid;
   const float *const d_coeffs = d->coeffs;
 
-  fprintf(stderr, "ELEPHANT: [TEMPERATURE] process(). ch = %d, bpc = %d, filters = %d\n", piece->colors, piece->bpc, filters);
-  dump_tmp(in, roi_in, piece->colors, "/tmp/temperature_bayer_in.tmp");
+  dump_tmp_span_t span = dump_tmp_span_begin("process", "temperature");
+  dump_tmp(in, roi_in, piece->colors, "temperature_bayer_in");
 
+  dump_tmp_span_t scale_span = dump_tmp_span_begin(
+      "omp", filters == 9u ? "temperature.xtrans" : filters ? "temperature.bayer" : "temperature.rgb");
   if(filters == 9u)
   { // xtrans float mosaiced
 #ifdef _OPENMP
@@ -510,7 +513,6 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
   }
   else if(filters)
   { // bayer float mosaiced
-    fprintf(stderr, "ELEPHANT: [TEMPERATURE] Bayer float mosaiced.\n");
     const int width = roi_out->width;
 #ifdef _OPENMP
 #pragma omp parallel for default(none) \
@@ -569,6 +571,7 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
     if(piece->pipe->mask_display & DT_DEV_PIXELPIPE_DISPLAY_MASK)
       dt_iop_alpha_copy(ivoid, ovoid, roi_out->width, roi_out->height);
   }
+  dump_tmp_span_end(&scale_span);
 
   piece->pipe->dsc.temperature.enabled = 1;
   for(int k = 0; k < 4; k++)
@@ -577,7 +580,8 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
     piece->pipe->dsc.processed_maximum[k] = d->coeffs[k] * piece->pipe->dsc.processed_maximum[k];
     self->dev->proxy.wb_coeffs[k] = d->coeffs[k];
   }
-  dump_tmp(out, roi_out, piece->colors, "/tmp/temperature_bayer_out.tmp");
+  dump_tmp(out, roi_out, piece->colors, "temperature_bayer_out");
+  dump_tmp_process_end(&span, roi_in, roi_out, piece->colors);
 }
 
 #if defined(__SSE__)
@@ -587,22 +591,26 @@ void process_sse2(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, c
   const uint32_t filters = piece->pipe->dsc.filters;
   dt_iop_temperature_data_t *d = (dt_iop_temperature_data_t *)piece->data;
 
-  fprintf(stderr, "ELEPHANT: [TEMPERATURE] process_sse2(). ch = %d, bpc = %d, filters = %d\n", piece->colors, piece->bpc, filters);
-
   if(filters)
   { // xtrans float mosaiced or bayer float mosaiced
     // plain C version is same speed for Bayer and actually a bit faster for Xtrans, so use it instead
-    fprintf(stderr, "ELEPHANT: [TEMPERATURE] process_sse2(): filters is not null: calling plain process.\n");
     process(self,piece,ivoid,ovoid,roi_in,roi_out);
     return;
   }
+  else if(__builtin_cpu_supports("avx2"))
+  {
+    // with AVX2, the clone of process() picked at runtime beats the 128-bit intrinsics below
+    process(self, piece, ivoid, ovoid, roi_in, roi_out);
+    return;
+  }
   else
   {
-    fprintf(stderr, "ELEPHANT: [TEMPERATURE] process_sse2(): nonmosaic path.\n");
      // non-mosaiced
+    dump_tmp_span_t span = dump_tmp_span_begin("process", "temperature");
     const size_t ch = piece->colors;
 
     const __m128 coeffs = _mm_set_ps(1.0f, d->coeffs[2], d->coeffs[1], d->coeffs[0]);
+    dump_tmp_span_t scale_span = dump_tmp_span_begin("omp", "temperature.rgb_sse2");
 
 #ifdef _OPENMP
 #pragma omp parallel for default(none) \
@@ -622,9 +630,11 @@ void process_sse2(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, c
       }
     }
     _mm_sfence();
+    dump_tmp_span_end(&scale_span);
 
     if(piece->pipe->mask_display & DT_DEV_PIXELPIPE_DISPLAY_MASK)
       dt_iop_alpha_copy(ivoid, ovoid, roi_out->width, roi_out->height);
+    dump_tmp_process_end(&span, roi_in, roi_out, ch);
   }
 
   piece->pipe->dsc.temperature.enabled = 1;
@@ -0,0 +1,149 @@
+# Microbenchmarks for the process() kernels of the eight tapped modules.
+#
+# Every module runs on a synthetic buffer at several resolutions and OpenMP
+# thread counts through libdarktable_kernels (see darktable_kernels.py). For
+# each case it reports megapixels per second and the scaling efficiency
+# relative to the smallest thread count: speedup / thread ratio, so 1.0 is
+# perfect scaling.
+#
+# colorin, colorout and temperature run both their process() and
+# process_sse2() codepaths. Each row names the code it timed: process, or
+# process/<isa> for the clone the CPU runs of a process() built for several
+# instruction sets (__DT_CLONE_TARGETS__); sse2 for the intrinsics, or
+# sse2->process... for a process_sse2() that hands this input to process().
+# filmicrgb gets an input with clipped highlights, so that its highlight
+# reconstruction runs.
+#
+#   python benchmark_kernels.py
+#   python benchmark_kernels.py --modules filmicrgb --mp 24 --threads 1,8,32
+#   python benchmark_kernels.py --json results.json
+import argparse
+import json
+import os
+
+import numpy as np
+
+import darktable_kernels
+import darktable_pipe
+
+# Modules with both a plain and an SSE2 codepath worth comparing.
+_SSE2_MODULES = {"colorin", "colorout", "temperature"}
+
+
+def synthetic_image(op, megapixels, seed=0):
+    """A 3:2 (height, width[, 4]) float32 buffer for op: a Bayer mosaic for
+    the raw modules, scene-referred RGB otherwise."""
+    height = int(round(np.sqrt(megapixels * 1e6 / 1.5)))
+    width = int(round(height * 1.5))
+    rng = np.random.default_rng(seed)
+    if op in ("temperature", "highlights"):
+        # Raw data in [0, 1], a few percent clipped.
+        return np.clip(rng.uniform(0.0, 1.05, (height, width)), 0.0,
+                       1.0).astype(np.float32)
+    # Log-normal around middle gray; about 0.5% of the pixels are more than
+    # 3 EV above white, which triggers filmicrgb's reconstruction.
+    rgb = rng.lognormal(np.log(0.18), 1.5, (height, width, 4))
+    return rgb.astype(np.float32)
+
+
+def default_params(op):
+    return {
+        "temperature": darktable_pipe.TemperatureParams(),
+        "highlights": darktable_pipe.HighlightsParams(),
+        "exposure": darktable_pipe.ExposureParams(exposure=0.5),
+        "sharpen": darktable_pipe.SharpenParams(),
+        "colorbalancergb": darktable_pipe.ColorBalanceRGBParams(contrast=0.3),
+        "filmicrgb": darktable_pipe.FilmicRGBParams(),
+    }.get(op)
+
+
+def _sse2_runs_process(op, clone_target, filters):
+    # See process_sse2() in temperature.c and colorout.c: temperature always
+    # hands mosaics to process(), and with AVX2 both hand it everything.
+    avx2 = clone_target in ("avx2", "avx512f")
+    return ((op == "temperature" and (filters or avx2)) or
+            (op == "colorout" and avx2))
+
+
+def _process_cloned(op, filters):
+    # highlights only clones its clipping of RGB input.
+    return (op in ("exposure", "temperature", "colorout") or
+            (op == "highlights" and not filters))
+
+
+def codepaths(op, clone_target, filters):
+    """Maps the name of the code each codepath of op runs to the codepath."""
+    process = (f"process/{clone_target}"
+               if _process_cloned(op, filters) else "process")
+    if op not in _SSE2_MODULES:
+        return {process: darktable_kernels.CODEPATH_DEFAULT}
+    sse2 = (f"sse2->{process}"
+            if _sse2_runs_process(op, clone_target, filters) else "sse2")
+    return {
+        process: darktable_kernels.CODEPATH_PLAIN,
+        sse2: darktable_kernels.CODEPATH_SSE2
+    }
+
+
+def parse_args():
+    cores = len(os.sched_getaffinity(0))
+    default_threads = sorted({1, 2, 4, 8, 16, 32, 64, cores} & set(range(1, cores + 1)))
+    parser = argparse.ArgumentParser(description="iop kernel microbenchmarks")
+    parser.add_argument("--modules", default=",".join(darktable_kernels.MODULES))
+    parser.add_argument("--mp", default="2,12,24,50",
+                        help="comma-separated resolutions in megapixels")
+    parser.add_argument("--threads", default=",".join(map(str, default_threads)))
+    parser.add_argument("--repeat", type=int, default=3,
+                        help="timed process() calls per case, after one warm-up")
+    parser.add_argument("--json", default=None,
+                        help="also write the results to this file")
+    return parser.parse_args()
+
+
+def main():
+    args = parse_args()
+    kernels = darktable_kernels.Kernels()
+    threads_list = [int(t) for t in args.threads.split(",")]
+    clone_target = kernels.clone_target()
+    results = []
+
+    print(f"{'module':<16} {'codepath':<22} {'MP':>4} {'threads':>7} "
+          f"{'MP/s':>9} {'efficiency':>10}")
+    for op in args.modules.split(","):
+        params = default_params(op)
+        filters = darktable_kernels.FILTERS_RGGB if op in (
+            "temperature", "highlights") else 0
+        for mp in [float(m) for m in args.mp.split(",")]:
+            image = synthetic_image(op, mp)
+            pixels = image.shape[0] * image.shape[1]
+            for name, codepath in codepaths(op, clone_target,
+                                            filters).items():
+                single = None
+                for threads in threads_list:
+                    kernels.set_threads(threads)
+                    # Warm up caches, page in the output and let OpenMP spawn
+                    # its team before timing.
+                    kernels.time(op, image, params, filters, codepath)
+                    _, seconds = kernels.time(op, image, params, filters,
+                                              codepath, args.repeat)
+                    mps = pixels / seconds / 1e6
+                    if threads == threads_list[0]:
+                        # Per-thread throughput of the smallest team.
+                        single = mps / threads
+                    efficiency = mps / (single * threads)
+                    results.append(
+                        dict(module=op, codepath=name, megapixels=mp,
+                             width=image.shape[1], height=image.shape[0],
+                             threads=threads, seconds=seconds,
+                             megapixels_per_second=mps,
+                             efficiency=efficiency))
+                    print(f"{op:<16} {name:<22} {mp:>4g} {threads:>7} "
+                          f"{mps:>9.1f} {efficiency:>10.2f}")
+
+    if args.json:
+        with open(args.json, "w") as f:
+            json.dump(results, f, indent=2)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,156 @@
+# Runs the process() kernel of a single darktable iop on a numpy array.
+#
+# Wraps libdarktable_kernels (darktable/src/cli/kernels.c) with ctypes. No raw
+# file, XMP or pipe is involved: the module gets its params, a whole-image
+# region of interest and the array, and its output comes back as an array of
+# the same shape. Params are the dataclasses from darktable_pipe.py (anything
+# with to_hex_string()), raw bytes of the C params struct, or None for the
+# module's defaults.
+#
+#   kernels = darktable_kernels.Kernels()
+#   out = kernels.sharpen(rgb, darktable_pipe.SharpenParams(amount=2.0))
+#
+# RGB modules take (height, width, 3) or (height, width, 4) float32 arrays;
+# temperature and highlights also take (height, width) raw mosaics together
+# with their CFA `filters`. Blending and masks are not applied.
+import ctypes
+import os
+
+import numpy as np
+
+import darktable_pipe
+
+# libdarktable_kernels is installed next to libdarktable.
+_KERNELS_LIB = os.environ.get(
+    "DT_KERNELS_LIB",
+    os.path.join(os.path.dirname(darktable_pipe._DARKTABLE_CLI), "..", "lib",
+                 "darktable", "libdarktable_kernels.so"))
+
+# The eight modules tapped by dump_tmp(), in pipe order.
+MODULES = [
+    "temperature", "highlights", "exposure", "colorin", "sharpen",
+    "colorbalancergb", "filmicrgb", "colorout"
+]
+
+# Codepaths, see dt_kernels_codepath_t in kernels.c.
+CODEPATH_DEFAULT = 0
+CODEPATH_PLAIN = 1
+CODEPATH_SSE2 = 2
+
+# Modules that also run on single-channel raw mosaics.
+_RAW_MODULES = {"temperature", "highlights"}
+
+# CFA filters of the common Bayer layouts, see dt_image_t.buf_dsc.filters.
+FILTERS_RGGB = 0x94949494
+FILTERS_BGGR = 0x16161616
+FILTERS_GRBG = 0x61616161
+FILTERS_GBRG = 0x49494949
+
+
+def _params_bytes(params):
+    if params is None:
+        return None
+    if isinstance(params, (bytes, bytearray)):
+        return bytes(params)
+    return bytes.fromhex(params.to_hex_string())
+
+
+class Kernels:
+    """darktable, initialized in this process for running iop kernels.
+
+    darktable keeps global state, so create one Kernels per process.
+    """
+
+    def __init__(self, lib_path=_KERNELS_LIB, core_args=("--disable-opencl",)):
+        self._lib = ctypes.CDLL(lib_path)
+        self._lib.dt_kernels_init.argtypes = [
+            ctypes.c_int, ctypes.POINTER(ctypes.c_char_p)
+        ]
+        self._lib.dt_kernels_params_size.argtypes = [ctypes.c_char_p]
+        self._lib.dt_kernels_process.argtypes = [
+            ctypes.c_char_p, ctypes.c_char_p, ctypes.c_size_t,
+            ctypes.c_void_p, ctypes.c_void_p, ctypes.c_int, ctypes.c_int,
+            ctypes.c_int, ctypes.c_uint32, ctypes.c_int, ctypes.c_int,
+            ctypes.POINTER(ctypes.c_double), ctypes.c_char_p, ctypes.c_size_t
+        ]
+        self._lib.dt_kernels_set_threads.argtypes = [ctypes.c_int]
+        self._lib.dt_kernels_clone_target.restype = ctypes.c_char_p
+
+        args = [
+            "darktable-kernels", "--library", ":memory:", "--conf",
+            "write_sidecar_files=never", *core_args
+        ]
+        argv = (ctypes.c_char_p * (len(args) + 1))(
+            *[a.encode() for a in args], None)
+        if self._lib.dt_kernels_init(len(args), argv):
+            raise RuntimeError("darktable failed to initialize")
+
+        for op in MODULES:
+            setattr(self, op, self._bind(op))
+
+    def _bind(self, op):
+        def process(image, params=None, filters=0):
+            return self.process(op, image, params, filters)
+
+        process.__doc__ = f"Runs {op}'s process() on image, see process()."
+        return process
+
+    def params_size(self, op):
+        return self._lib.dt_kernels_params_size(op.encode())
+
+    def clone_target(self):
+        """The instruction set of the clones that cloned process() functions
+        run on this CPU, e.g. "avx2"."""
+        return self._lib.dt_kernels_clone_target().decode()
+
+    def set_threads(self, threads):
+        """Sets the number of OpenMP threads the kernels use."""
+        self._lib.dt_kernels_set_threads(threads)
+
+    def process(self, op, image, params=None, filters=0):
+        """Runs op's process() on image and returns the result.
+
+        image is (height, width) for a raw mosaic with CFA `filters`, or
+        (height, width, 3 or 4) for RGB; 3-channel input is padded to the
+        pipe's 4 channels and the padding dropped from the output.
+        """
+        return self.time(op, image, params, filters)[0]
+
+    def time(self, op, image, params=None, filters=0,
+             codepath=CODEPATH_DEFAULT, repeat=1):
+        """Like process(), but runs process() `repeat` times with `codepath`
+        and returns (output, seconds per call). Only the process() calls are
+        timed, not the module setup or the conversion of image.
+        """
+        image = np.asarray(image, dtype=np.float32)
+        channels_in = 1 if image.ndim == 2 else image.shape[2]
+        if channels_in == 1:
+            if op not in _RAW_MODULES or not filters:
+                raise ValueError(f"{op} needs RGB input, or a raw mosaic "
+                                 "with filters")
+            buffer = np.ascontiguousarray(image.reshape(image.shape[:2]))
+            channels = 1
+        elif channels_in in (3, 4):
+            buffer = np.zeros(image.shape[:2] + (4,), np.float32)
+            buffer[..., :channels_in] = image
+            channels = 4
+            filters = 0
+        else:
+            raise ValueError(f"unsupported image shape {image.shape}")
+        out = np.empty_like(buffer)
+
+        blob = _params_bytes(params)
+        error = ctypes.create_string_buffer(256)
+        seconds = ctypes.c_double()
+        height, width = buffer.shape[:2]
+        if self._lib.dt_kernels_process(op.encode(), blob,
+                                        len(blob) if blob else 0,
+                                        buffer.ctypes.data, out.ctypes.data,
+                                        width, height, channels, filters,
+                                        codepath, repeat, ctypes.byref(seconds),
+                                        error, len(error)):
+            raise RuntimeError(f"{op}: {error.value.decode()}")
+
+        if channels == 1:
+            return out.reshape(image.shape), seconds.value
+        return out[..., :channels_in], seconds.value
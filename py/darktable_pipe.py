@@ -1,9 +1,16 @@
+import fnmatch
+import glob
+import itertools
+import json
+import loadTMP
 import math
 import numpy as np
 import os
+import resource
 import struct
 import subprocess
 import tempfile
+import time
 from dataclasses import dataclass, field, fields
 from sys import platform
 
@@ -16,6 +23,11 @@ elif platform == "darwin":
 else:
     raise NotImplementedError("platform not supported")
 
+# darktable-render-server (darktable/src/cli/render_server.c) is installed next
+# to darktable-cli.
+_DARKTABLE_RENDER_SERVER = os.path.join(os.path.dirname(_DARKTABLE_CLI),
+                                        "darktable-render-server")
+
 _FMT_STR = '''<?xml version="1.0" encoding="UTF-8"?>
 <x:xmpmeta xmlns:x="adobe:ns:meta/" x:xmptk="XMP Core 4.4.0-Exiv2">
  <rdf:RDF xmlns:rdf="http://www.w3.org/1999/02/22-rdf-syntax-ns#">
@@ -499,17 +511,337 @@ def get_pipe_xmp(raw_prepare_params=RawPrepareParams(),
         filmicrgb_params=to_hex(filmicrgb_params, FilmicRGBParams()))
 
 
-def render(src_dng_path, dst_path, pipe_stage_flags):
+def tap_selected(tap, taps=None):
+    """Mirrors dump_tmp_selected() in dump_tmp.h: is `tap` (e.g.
+    "colorbalancergb_out") written when DT_TAP_SELECT is ",".join(taps)?"""
+    if taps is None:
+        return True
+    return any(
+        fnmatch.fnmatchcase(tap, p) or fnmatch.fnmatchcase(tap, p + "_*")
+        for p in taps if p and p != "none")
+
+
+def tap_env(tap_dir=None, tap_prefix=None, taps=None, tap_format=None,
+            tap_crop=None, tap_downsample=None, tap_filter=None,
+            tap_layout=None, tap_trace=None, tap_store=None,
+            tap_stats_bins=None, sharpen_sweep=None):
+    """Returns a copy of os.environ that points darktable's tap-outs
+    (dump_tmp.h) at <tap_dir>/<tap_prefix><stage>_{in,out}.tmp.
+
+    taps is a list of tap patterns to write, e.g. ["colorbalancergb"] or
+    ["sharpen_out", "*_in"]; an empty list disables every tap.
+
+    tap_format="tiff" makes darktable write <stage>_{in,out}.tif directly,
+    with the same contents tmp2tiff() would produce from the .tmp file.
+    tap_format="stats" writes <stage>_{in,out}.json with per-channel min,
+    max, mean, std, percentiles and a histogram instead of the pixels (see
+    dump_tmp_stats() in dump_tmp.h); tap_stats_bins sets the histogram size.
+
+    tap_crop=(x, y, width, height) crops every tap, and tap_downsample=n then
+    shrinks it n times with tap_filter "box" (the default) or "bilinear".
+
+    tap_layout is "planar" (the default) or "interleaved", see DT_TMP_LAYOUT.
+
+    tap_trace is a file the render appends its timing trace to, one JSON
+    object per line (see DT_TAP_TRACE in dump_tmp.h and pipe_trace.py).
+
+    tap_store is a directory where every distinct tap is stored once, under
+    its content hash; the tap paths become symlinks into it (see
+    DT_TAP_STORE in dump_tmp.h and tap_store.py).
+
+    sharpen_sweep is a list of sharpen amounts or (amount, threshold) pairs;
+    sharpen then also writes the tap sharpen_out_<k> for the k-th one, reusing
+    its blur (see DT_TAP_SHARPEN_SWEEP in sharpen.c).
+
+    Unset arguments keep whatever DT_TAP_DIR / DT_TAP_PREFIX / DT_TAP_SELECT
+    the caller's environment already has (darktable defaults to /tmp, no
+    prefix and every tap).
+    """
+    env = dict(os.environ)
+    if tap_dir is not None:
+        os.makedirs(tap_dir, exist_ok=True)
+        env["DT_TAP_DIR"] = tap_dir
+    if tap_prefix is not None:
+        env["DT_TAP_PREFIX"] = tap_prefix
+    if taps is not None:
+        env["DT_TAP_SELECT"] = ",".join(taps) if taps else "none"
+    if tap_format is not None:
+        env["DT_TAP_FORMAT"] = tap_format
+    if tap_crop is not None:
+        env["DT_TAP_CROP"] = ",".join(str(int(v)) for v in tap_crop)
+    if tap_downsample is not None:
+        env["DT_TAP_DOWNSAMPLE"] = str(int(tap_downsample))
+    if tap_filter is not None:
+        env["DT_TAP_DOWNSAMPLE_FILTER"] = tap_filter
+    if tap_layout is not None:
+        env["DT_TMP_LAYOUT"] = tap_layout
+    if tap_stats_bins is not None:
+        env["DT_TAP_STATS_BINS"] = str(int(tap_stats_bins))
+    if tap_trace is not None:
+        env["DT_TAP_TRACE"] = os.path.abspath(tap_trace)
+    if tap_store is not None:
+        os.makedirs(tap_store, exist_ok=True)
+        env["DT_TAP_STORE"] = os.path.abspath(tap_store)
+    if sharpen_sweep is not None:
+        env["DT_TAP_SHARPEN_SWEEP"] = ",".join(
+            ":".join(str(float(v)) for v in pair)
+            if isinstance(pair, (tuple, list)) else str(float(pair))
+            for pair in sharpen_sweep)
+    return env
+
+
+# Environment variables that configure the tap-outs, see dump_tmp.h.
+_TAP_ENV_PREFIXES = ("DT_TAP_", "DT_TMP_")
+_RENDER_SERVER_REPLY = "[render_server] "
+# RenderServer outputs named shm:<name> go to /dev/shm/<name>, see
+# render_array().
+_SHM_OUTPUT = "shm:"
+_SHM_DIR = "/dev/shm"
+_shm_names = itertools.count()
+
+
+class RenderServer:
+    """A long-lived darktable-render-server process.
+
+    darktable is initialized once, when the server starts, instead of once per
+    render like darktable-cli. Pass it to render() as server=, or use it as a
+    context manager:
+
+        with darktable_pipe.RenderServer() as server:
+            for amount in amounts:
+                render(src, f"/tmp/sharpen_{amount}.tif", params, server=server)
+
+    Tap settings are sent to the server before each render, so every render
+    can use different tap_kwargs. DT_TAP_ASYNC is the exception: the server
+    reads it once, from the environment it was started with.
+    """
+
+    def __init__(self, core_args=("--disable-opencl", "-d", "perf"), env=None,
+                 cpus=None):
+        """env replaces os.environ for the server, e.g. to set OMP_NUM_THREADS.
+        cpus optionally pins the server (and all its threads) to those CPUs.
+        """
+        args = [_DARKTABLE_RENDER_SERVER, "--core", *core_args]
+        env = dict(os.environ) if env is None else env
+        preexec_fn = None
+        if cpus is not None:
+            preexec_fn = lambda: os.sched_setaffinity(0, cpus)
+        print('Starting:\n', ' '.join(args), '\n')
+        self._proc = subprocess.Popen(args, stdin=subprocess.PIPE,
+                                      stdout=subprocess.PIPE, env=env,
+                                      text=True, bufsize=1,
+                                      preexec_fn=preexec_fn)
+        self._tap_env = {
+            k: v for k, v in env.items() if k.startswith(_TAP_ENV_PREFIXES)
+        }
+        self._read_reply()
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, *exc):
+        self.close()
+
+    def _read_reply(self):
+        # Pass darktable's own output (e.g. -d perf) through.
+        for line in self._proc.stdout:
+            if not line.startswith(_RENDER_SERVER_REPLY):
+                print(line, end='')
+                continue
+            fields = line[len(_RENDER_SERVER_REPLY):].rstrip('\n').split('\t')
+            if fields[0] == "error":
+                raise RuntimeError("darktable-render-server: %s: %s" %
+                                   (fields[1], fields[2]))
+            return fields[1:]
+        raise RuntimeError("darktable-render-server exited with code %s" %
+                           self._proc.wait())
+
+    def _request(self, *fields):
+        self._proc.stdin.write('\t'.join(fields) + '\n')
+        self._proc.stdin.flush()
+        return self._read_reply()
+
+    def set_tap_env(self, env):
+        """Makes the server's DT_TAP_* / DT_TMP_* variables match env."""
+        tap_env = {k: v for k, v in env.items() if k.startswith(_TAP_ENV_PREFIXES)}
+        for name in self._tap_env.keys() - tap_env.keys():
+            self._request("env", name, "")
+        for name, value in tap_env.items():
+            if self._tap_env.get(name) != value:
+                self._request("env", name, value)
+        self._tap_env = tap_env
+
+    def render(self, src_path, xmp_path, dst_path, env=None):
+        """Renders src_path with the history in xmp_path to dst_path.
+
+        Returns the server-side render time in seconds.
+        """
+        if env is not None:
+            self.set_tap_env(env)
+        if not dst_path.startswith(_SHM_OUTPUT):
+            # Like darktable-cli, write dst_path itself rather than a new name.
+            if os.path.exists(dst_path):
+                os.remove(dst_path)
+            dst_path = os.path.abspath(dst_path)
+        _, seconds = self._request("render", os.path.abspath(src_path),
+                                   os.path.abspath(xmp_path), dst_path)
+        return float(seconds)
+
+    def hold(self, src_path, cache_entries=None):
+        """Decodes src_path and keeps it decoded until release(), so that the
+        renders in between skip the raw decode.
+
+        cache_entries sets DT_PIPE_CACHE_ENTRIES for this hold: how many
+        module outputs its pipe keeps between renders (server default 3).
+        """
+        if cache_entries is not None:
+            self._request("env", "DT_PIPE_CACHE_ENTRIES", str(cache_entries))
+        self._request("hold", os.path.abspath(src_path))
+
+    def release(self, src_path):
+        self._request("release", os.path.abspath(src_path))
+
+    def close(self):
+        if self._proc.poll() is None:
+            self._request("quit")
+            self._proc.stdin.close()
+            self._proc.wait()
+
+
+def render(src_dng_path, dst_path, pipe_stage_flags, server=None,
+           **tap_kwargs):
+    """Renders src_dng_path to dst_path with darktable-cli, or with a running
+    RenderServer if server is given.
+
+    tap_kwargs (tap_dir, taps, tap_format, ...) configure the tap-outs, see
+    tap_env().
+    """
     with tempfile.NamedTemporaryFile(mode="w+t", suffix=".xmp",
                                      delete=False) as f:
         f.write(get_pipe_xmp(**pipe_stage_flags))
         xmp_path = f.name
+    if server is not None:
+        server.render(src_dng_path, xmp_path, dst_path, tap_env(**tap_kwargs))
+        os.remove(xmp_path)
+        return
     args = [
         _DARKTABLE_CLI, src_dng_path, xmp_path, dst_path, "--core",
         "--disable-opencl", "-d", "perf"
     ]
     print('Running:\n', ' '.join(args), '\n')
-    subprocess.run(args)
+    env = tap_env(**tap_kwargs)
+    start = time.monotonic()
+    cpu_start = resource.getrusage(resource.RUSAGE_CHILDREN)
+    proc = subprocess.Popen(args, env=env)
+    proc.wait()
+    if tap_kwargs.get("tap_trace") is not None:
+        # darktable-cli has no render event of its own, see render_server.c.
+        cpu_end = resource.getrusage(resource.RUSAGE_CHILDREN)
+        cpu = (cpu_end.ru_utime + cpu_end.ru_stime - cpu_start.ru_utime -
+               cpu_start.ru_stime)
+        _append_trace(env["DT_TAP_TRACE"], {
+            "cat": "render", "name": dst_path, "input": src_dng_path,
+            "ok": proc.returncode == 0, "pid": proc.pid,
+            "ts_us": int(start * 1e6),
+            "wall_us": int((time.monotonic() - start) * 1e6),
+            "process_cpu_us": int(cpu * 1e6)
+        })
+
+
+def _append_trace(path, event):
+    with open(path, "a") as f:
+        f.write(json.dumps(event) + "\n")
+
+
+def _map_shm(path):
+    """Maps the TMP file at path and unlinks it; the mapping keeps the memory
+    alive until the returned array is garbage collected."""
+    try:
+        return loadTMP.mmapTMP(path)[0]
+    finally:
+        os.unlink(path)
+
+
+def render_array(src_dng_path, pipe_stage_flags, server=None, shm_taps=None,
+                 **tap_kwargs):
+    """Renders src_dng_path and returns the result as a (height, width, 3)
+    float32 array, without writing or reading an image file.
+
+    The render server leaves the float pipe output (in the output profile, as
+    a 32-bit float TIFF export would contain) in POSIX shared memory and the
+    array maps it directly.
+
+    shm_taps is an optional list of tap patterns (see tap_env()) that are also
+    written to shared memory, interleaved. Then (image, taps) is returned,
+    where taps maps tap names such as "sharpen_out" to (height, width,
+    channels) arrays.
+
+    Without a server, a RenderServer is started for this render.
+    """
+    if server is None:
+        with RenderServer() as server:
+            return render_array(src_dng_path, pipe_stage_flags, server,
+                                shm_taps, **tap_kwargs)
+
+    name = f"dt_render_{os.getpid()}_{next(_shm_names)}"
+    tap_prefix = os.path.join(_SHM_DIR, name + "_")
+    if shm_taps is not None:
+        tap_kwargs.update(tap_dir=_SHM_DIR, tap_prefix=name + "_",
+                          taps=shm_taps, tap_format="tmp",
+                          tap_layout="interleaved")
+    try:
+        render(src_dng_path, _SHM_OUTPUT + name, pipe_stage_flags,
+               server=server, **tap_kwargs)
+        image = _map_shm(os.path.join(_SHM_DIR, name))[..., :3]
+        if shm_taps is None:
+            return image
+
+        taps = {}
+        for path in glob.glob(glob.escape(tap_prefix) + "*.tmp"):
+            taps[path[len(tap_prefix):-len(".tmp")]] = _map_shm(path)
+        return image, taps
+    finally:
+        # _map_shm() unlinks what it maps; this removes whatever a failed
+        # render, or a failure while mapping, left in /dev/shm.
+        leftovers = [os.path.join(_SHM_DIR, name)]
+        if shm_taps is not None:
+            leftovers += glob.glob(glob.escape(tap_prefix) + "*.tmp")
+        for path in leftovers:
+            try:
+                os.unlink(path)
+            except FileNotFoundError:
+                pass
+
+
+def render_batch(src_dng_path, variants, server=None, cache_entries=None,
+                 **tap_kwargs):
+    """Renders several histories of src_dng_path, decoding the raw once.
+
+    variants is a list of (dst_path, pipe_stage_flags) or (dst_path,
+    pipe_stage_flags, variant_tap_kwargs) tuples; variant_tap_kwargs override
+    tap_kwargs for that render, e.g. a tap_prefix per variant so that their
+    tap-outs don't overwrite each other.
+
+    cache_entries is passed to RenderServer.hold(); renders reuse the input
+    of the first changed module only if it is at least the number of enabled
+    modules from that one to the end of the pipe.
+
+    darktable-cli can't share a decode between invocations, so without a
+    server a RenderServer is started for the duration of the batch.
+    """
+    if server is None:
+        with RenderServer() as server:
+            return render_batch(src_dng_path, variants, server, cache_entries,
+                                **tap_kwargs)
+
+    server.hold(src_dng_path, cache_entries)
+    try:
+        for dst_path, pipe_stage_flags, *variant_tap_kwargs in variants:
+            kwargs = dict(tap_kwargs, **(variant_tap_kwargs or [{}])[0])
+            render(src_dng_path, dst_path, pipe_stage_flags, server=server,
+                   **kwargs)
+    finally:
+        server.release(src_dng_path)
 
 
 def render_stages(src_dng_path, dst_dir):
@@ -5,44 +5,230 @@
 #
 # The output is permutted into the numpy C-contiguous convention: (frames, height, width, channels).
 #   channels changes the fastest in memory, frames the slowest.
+#
+# darktable's dump_tmp() can also write a non-standard interleaved variant,
+# flagged in the high bits of the type code (see DT_TMP_FLAG_INTERLEAVED in
+# dump_tmp.h). Those files are already stored (frames, height, width, channels)
+# and are returned without a transpose.
+#
+# dump_tmp() may also write float16 samples (type code 10, not in ImageStack)
+# or uint16 samples flagged as normalized, which are decoded to float32 in
+# [0, 1].
+#
+# Files flagged DT_TMP_FLAG_DEFLATE store their samples as independently
+# zlib-compressed bands of rows (see dump_tmp_compressed()). Pass rows=(start,
+# stop) to loadTMP() to decompress only the bands covering those rows.
+#
+# mmapTMP() returns a lazy, memory-mapped view of a TMP file instead: indexing
+# it reads (and decodes) only the pages or bands the requested slice touches.
+import zlib
+
 import numpy as np
 
-def loadTMP(filename):
-    with open(filename, 'rb') as f:
-        buffer = f.read()
+# Must match the DT_TMP_FLAG_* defines in darktable/src/iop/dump_tmp.h.
+_TYPE_CODE_MASK = 0xffff
+_FLAG_INTERLEAVED = 1 << 16
+_FLAG_NORMALIZED = 1 << 17
+_FLAG_DEFLATE = 1 << 18
+
+_HEADER_SIZE = 5 * 4
+
+_TYPE_CODE_LIST = \
+[
+    np.dtype(np.float32),
+    np.dtype(np.float64),
+    np.dtype(np.uint8),
+    np.dtype(np.int8),
+    np.dtype(np.uint16),
+    np.dtype(np.int16),
+    np.dtype(np.uint32),
+    np.dtype(np.int32),
+    np.dtype(np.uint64),
+    np.dtype(np.int64),
+    np.dtype(np.float16),
+]
 
-    type_code_list = \
-    [
-        np.dtype(np.float32),
-        np.dtype(np.float64),
-        np.dtype(np.uint8),
-        np.dtype(np.int8),
-        np.dtype(np.uint16),
-        np.dtype(np.int16),
-        np.dtype(np.uint32),
-        np.dtype(np.int32),
-        np.dtype(np.uint64),
-        np.dtype(np.int64),
-    ]
-
-    offset = 0
-    tmp_dims = np.frombuffer(buffer, count=4, dtype=np.int32)
-    offset += tmp_dims.nbytes
-    type_code = np.frombuffer(buffer, count=1, offset=offset, dtype=np.int32)
-    offset += type_code.nbytes
-    data_type = type_code_list[int(type_code)]
 
+def _parse_header(buffer):
     # The TMP file writes the dimensions as:
     #   [width height frames channels]
-    # Rewrite it in the numpy order:
-    #   (channels, frames, height, width)
-    a2_dims = np.flipud(tmp_dims)
+    tmp_dims = np.frombuffer(buffer, count=4, dtype=np.int32)
+    type_code = int(np.frombuffer(buffer, count=1, offset=16, dtype=np.int32)[0])
+    flags = type_code & ~_TYPE_CODE_MASK
+    data_type = _TYPE_CODE_LIST[type_code & _TYPE_CODE_MASK]
+    return tuple(int(d) for d in tmp_dims), data_type, flags
+
+
+def _decompress_rows(buffer, dims, data_type, flags, start, stop):
+    """Decodes rows [start, stop) of every frame-row plane of a deflate TMP.
+
+    Returns an array in storage order with the row range applied:
+    (channels, frames * (stop - start), width) when planar, or
+    (frames * (stop - start), width, channels) when interleaved.
+    """
+    width, height, frames, channels = dims
+    band_rows, num_bands = np.frombuffer(buffer, count=2, offset=_HEADER_SIZE,
+                                         dtype=np.int32)
+    offsets = np.frombuffer(buffer, count=num_bands + 1,
+                            offset=_HEADER_SIZE + 8, dtype=np.uint64)
+
+    interleaved = bool(flags & _FLAG_INTERLEAVED)
+    planes = 1 if interleaved else channels
+    row_samples = width * channels if interleaved else width
+    plane_rows = frames * height
+    bands_per_plane = (plane_rows + band_rows - 1) // band_rows
+
+    first_band = start // band_rows
+    last_band = (stop - 1) // band_rows
+    out = []
+    for plane in range(planes):
+        bands = []
+        for b in range(first_band, last_band + 1):
+            i = plane * bands_per_plane + b
+            blob = buffer[int(offsets[i]):int(offsets[i + 1])]
+            bands.append(np.frombuffer(zlib.decompress(blob), dtype=data_type))
+        rows = np.concatenate(bands).reshape(-1, row_samples)
+        skip = start - first_band * band_rows
+        out.append(rows[skip:skip + stop - start])
+
+    if interleaved:
+        return out[0].reshape(stop - start, width, channels)
+    return np.stack(out)
+
+
+def loadTMP(filename, rows=None):
+    """Loads a TMP file as a (frames, height, width, channels) array.
+
+    rows: optional (start, stop) range of rows to return. For deflate files
+    only the bands overlapping the range are decompressed; it must be used with
+    single-frame files, which is all dump_tmp() writes.
+    """
+    with open(filename, 'rb') as f:
+        buffer = f.read()
+
+    dims, data_type, flags = _parse_header(buffer)
+    width, height, frames, channels = dims
+    start, stop = (0, height) if rows is None else rows
+    if flags & _FLAG_DEFLATE and (rows is not None and frames != 1):
+        raise ValueError("rows= is only supported for single-frame TMP files")
+
+    if flags & _FLAG_DEFLATE:
+        if rows is None:
+            start, stop = 0, frames * height
+        a = _decompress_rows(buffer, dims, data_type, flags, start, stop)
+        nrows = (stop - start) // frames
+        if flags & _FLAG_INTERLEAVED:
+            a = a.reshape(frames, nrows, width, channels)
+        else:
+            a = a.reshape(channels, frames, nrows, width).transpose((1, 2, 3, 0))
+    elif flags & _FLAG_INTERLEAVED:
+        # Buffer stores the data as: (frames, height, width, channels).
+        a = np.frombuffer(buffer, offset=_HEADER_SIZE, dtype=data_type)
+        a.shape = (frames, height, width, channels)
+        a = a[:, start:stop]
+    else:
+        # Rewrite the dimensions in the numpy order:
+        #   (channels, frames, height, width)
+        a2_dims = (channels, frames, height, width)
+
+        # Buffer stores the data as: (channels, frames, height, width).
+        a2 = np.frombuffer(buffer, offset=_HEADER_SIZE, dtype=data_type)
+        a2.shape = a2_dims
+
+        # Permute the dimensions so that the data is returned in the numpy C-contiguous convention:
+        #   (frames, height, width, channels).
+        a = a2.transpose((1, 2, 3, 0))[:, start:stop]
+
+    if flags & _FLAG_NORMALIZED:
+        a = a.astype(np.float32) / np.float32(np.iinfo(data_type).max)
+    return a
+
+
+class TMPView:
+    """A lazy (frames, height, width, channels) view of a TMP file.
+
+    The file is memory-mapped; nothing is read until the view is indexed, and
+    then only what the index touches. Selecting channels of a planar file
+    never maps the other planes, a crop of an interleaved file reads only its
+    rows, and a row range of a deflate file decompresses only its bands.
+    Indexing returns a numpy array; np.asarray(view) loads everything.
+    """
+
+    def __init__(self, filename):
+        self._buffer = np.memmap(filename, dtype=np.uint8, mode='r')
+        self._dims, self._data_type, self._flags = _parse_header(self._buffer)
+        width, height, frames, channels = self._dims
+        self.shape = (frames, height, width, channels)
+        self.dtype = np.dtype(np.float32) if self._flags & _FLAG_NORMALIZED \
+            else self._data_type
+        self.ndim = 4
+
+        self._raw = None
+        if not self._flags & _FLAG_DEFLATE:
+            raw = np.frombuffer(self._buffer, offset=_HEADER_SIZE,
+                                dtype=self._data_type)
+            if self._flags & _FLAG_INTERLEAVED:
+                self._raw = raw.reshape(self.shape)
+            else:
+                self._raw = raw.reshape(
+                    (channels, frames, height, width)).transpose((1, 2, 3, 0))
+
+    def __len__(self):
+        return self.shape[0]
+
+    def __array__(self, dtype=None, copy=None):
+        a = self[...]
+        return a if dtype is None else a.astype(dtype)
+
+    def __getitem__(self, key):
+        if self._raw is not None:
+            a = self._raw[key]
+        else:
+            a = self._getitem_deflate(key)
+        if self._flags & _FLAG_NORMALIZED:
+            a = a.astype(np.float32) / np.float32(
+                np.iinfo(self._data_type).max)
+        return a
+
+    def _getitem_deflate(self, key):
+        key = key if isinstance(key, tuple) else (key,)
+        if any(k is Ellipsis for k in key):
+            i = next(i for i, k in enumerate(key) if k is Ellipsis)
+            key = key[:i] + (slice(None),) * (5 - len(key)) + key[i + 1:]
+        key = key + (slice(None),) * (4 - len(key))
+        frames, height, width, channels = self.shape
+
+        # Decompress only the bands covering the requested rows, then apply the
+        # rest of the index to the decoded rows.
+        rows = key[1]
+        if isinstance(rows, slice):
+            start, stop, step = rows.indices(height)
+            if step < 0 or start >= stop:
+                start, stop, rows = 0, height, rows
+            else:
+                rows = slice(0, stop - start, step)
+        else:
+            row_list = np.arange(height)[rows]
+            if row_list.size == 0:
+                return np.zeros((frames, 0, width, channels), self._data_type)[
+                    (key[0], slice(None), key[2], key[3])]
+            start = int(row_list.min())
+            stop = int(row_list.max()) + 1
+            rows = row_list - start
+        if frames != 1:
+            start, stop, rows = 0, height, key[1]
 
-    # Buffer stores the data as: (channels, frames, height, width).
-    a2 = np.frombuffer(buffer, offset=offset, dtype=data_type)
-    a2.shape = a2_dims
+        a = _decompress_rows(self._buffer, self._dims, self._data_type,
+                             self._flags, start * frames, stop * frames)
+        nrows = stop - start
+        if self._flags & _FLAG_INTERLEAVED:
+            a = a.reshape(frames, nrows, width, channels)
+        else:
+            a = a.reshape(channels, frames, nrows, width).transpose(
+                (1, 2, 3, 0))
+        return a[(key[0], rows, key[2], key[3])]
 
-    # Permute the dimensions so that the data is returned in the numpy C-contiguous convention:
-    #   (frames, height, width, channels).
-    return a2.transpose((1, 2, 3, 0))
 
+def mmapTMP(filename):
+    """Returns a lazy TMPView of filename, see TMPView."""
+    return TMPView(filename)
@@ -1,13 +1,21 @@
 import darktable_pipe
 import numpy as np
+import os
 import rawpy
 import sys
 
 # Runs a parameter sweep through a minimal pipeline on a single image.
 # The parameter sweep is done on two stages: contrast and sharpen amount.
+#
+# Extra keyword arguments to the *_pipe() functions (tap_dir, tap_prefix, taps)
+# are forwarded to darktable_pipe.render().
+#
+# The *_sweep_pipe() functions render a whole sweep with
+# darktable_pipe.render_batch(), which decodes the DNG once for all values.
 
 
-def minimal_pipe(src_dng, raw_prepare_params, temperature_params, output_tif):
+def minimal_pipe(src_dng, raw_prepare_params, temperature_params, output_tif,
+                 **render_kwargs):
     params_dicts = {
         'filmicrgb_params': None,
         'colorbalancergb_params': None,
@@ -18,15 +26,14 @@ def minimal_pipe(src_dng, raw_prepare_params, temperature_params, output_tif):
         'raw_prepare_params': raw_prepare_params,
     }
 
-    darktable_pipe.render(src_dng, output_tif, params_dicts)
+    darktable_pipe.render(src_dng, output_tif, params_dicts, **render_kwargs)
 
 
-def contrast_only_pipe(src_dng, raw_prepare_params, temperature_params,
-                       contrast, output_tif):
+def contrast_only_params(raw_prepare_params, temperature_params, contrast):
     colorbalancergb_params = darktable_pipe.ColorBalanceRGBParams()
     colorbalancergb_params.contrast = contrast
 
-    params_dicts = {
+    return {
         'filmicrgb_params': None,
         'colorbalancergb_params': colorbalancergb_params,
         'sharpen_params': None,
@@ -36,15 +43,12 @@ def contrast_only_pipe(src_dng, raw_prepare_params, temperature_params,
         'raw_prepare_params': raw_prepare_params,
     }
 
-    darktable_pipe.render(src_dng, output_tif, params_dicts)
-
 
-def sharpen_only_pipe(src_dng, raw_prepare_params, temperature_params, amount,
-                      output_tif):
+def sharpen_only_params(raw_prepare_params, temperature_params, amount):
     sharpen_params = darktable_pipe.SharpenParams()
     sharpen_params.amount = amount
 
-    params_dicts = {
+    return {
         'filmicrgb_params': None,
         'colorbalancergb_params': None,
         'sharpen_params': sharpen_params,
@@ -54,7 +58,77 @@ def sharpen_only_pipe(src_dng, raw_prepare_params, temperature_params, amount,
         'raw_prepare_params': raw_prepare_params,
     }
 
-    darktable_pipe.render(src_dng, output_tif, params_dicts)
+
+def contrast_only_pipe(src_dng, raw_prepare_params, temperature_params,
+                       contrast, output_tif, **render_kwargs):
+    params_dicts = contrast_only_params(raw_prepare_params, temperature_params,
+                                        contrast)
+    darktable_pipe.render(src_dng, output_tif, params_dicts, **render_kwargs)
+
+
+def sharpen_only_pipe(src_dng, raw_prepare_params, temperature_params, amount,
+                      output_tif, **render_kwargs):
+    params_dicts = sharpen_only_params(raw_prepare_params, temperature_params,
+                                       amount)
+    darktable_pipe.render(src_dng, output_tif, params_dicts, **render_kwargs)
+
+
+def _sweep_variants(make_params, raw_prepare_params, temperature_params,
+                    values, output_tifs, variant_kwargs):
+    if variant_kwargs is None:
+        variant_kwargs = [{}] * len(values)
+    return [(output_tif,
+             make_params(raw_prepare_params, temperature_params, value), kwargs)
+            for value, output_tif, kwargs in zip(values, output_tifs,
+                                                 variant_kwargs)]
+
+
+# variant_kwargs optionally gives per-value render kwargs, e.g. a tap_prefix
+# for each contrast, see darktable_pipe.render_batch().
+def contrast_sweep_pipe(src_dng, raw_prepare_params, temperature_params,
+                        contrasts, output_tifs, variant_kwargs=None,
+                        **render_kwargs):
+    variants = _sweep_variants(contrast_only_params, raw_prepare_params,
+                               temperature_params, contrasts, output_tifs,
+                               variant_kwargs)
+    # Enough cache lines to keep sharpen's output past colorbalancergb,
+    # colorout and gamma.
+    render_kwargs.setdefault("cache_entries", 4)
+    darktable_pipe.render_batch(src_dng, variants, **render_kwargs)
+
+
+def sharpen_sweep_pipe(src_dng, raw_prepare_params, temperature_params,
+                       amounts, output_tifs, variant_kwargs=None,
+                       **render_kwargs):
+    variants = _sweep_variants(sharpen_only_params, raw_prepare_params,
+                               temperature_params, amounts, output_tifs,
+                               variant_kwargs)
+    darktable_pipe.render_batch(src_dng, variants, **render_kwargs)
+
+
+# Renders a sharpen sweep in one render: sharpen blurs once and writes the tap
+# sharpen_out_<k> to tap_dir for every amounts[k] (and thresholds[k], if
+# given), see DT_TAP_SHARPEN_SWEEP in sharpen.c. output_tif is rendered with
+# amounts[0]. Returns the tap paths, in the order of amounts.
+def sharpen_sweep_taps(src_dng, raw_prepare_params, temperature_params,
+                       amounts, output_tif, tap_dir, thresholds=None,
+                       **render_kwargs):
+    sweep = (list(amounts) if thresholds is None else list(
+        zip(amounts, thresholds)))
+    params_dicts = sharpen_only_params(raw_prepare_params, temperature_params,
+                                       amounts[0])
+    render_kwargs.setdefault('taps', ['sharpen_out'])
+    darktable_pipe.render(src_dng, output_tif, params_dicts, tap_dir=tap_dir,
+                          sharpen_sweep=sweep, **render_kwargs)
+    extension = {
+        'tiff': '.tif',
+        'stats': '.json'
+    }.get(render_kwargs.get('tap_format'), '.tmp')
+    prefix = render_kwargs.get('tap_prefix') or ''
+    return [
+        os.path.join(tap_dir, f'{prefix}sharpen_out_{k}{extension}')
+        for k in range(len(sweep))
+    ]
 
 
 def read_dng_params(dng_file):
@@ -83,23 +157,25 @@ def main(argv):
 
     raw_prepare_params, temperature_params = read_dng_params(src_dng_path)
 
-    minimal_pipe(src_dng_path, raw_prepare_params, temperature_params,
-                 '/tmp/minimal_pipe.tif')
-
-    # colorbalancergb.contrast sweep
-    for contrast in np.linspace(-0.9, 0.9, 7):
-        # Need to cast np.float64 amount to Python's native float so it can be
-        # hexified properly.
-        contrast_only_pipe(src_dng_path,
-                           raw_prepare_params, temperature_params,
-                           float(contrast), f'/tmp/contrast_{contrast}.tif')
-
-    # sharpen.amount sweep
-    for amount in np.linspace(0.0, 10.0, 11):
-        # Need to cast np.float64 amount to Python's native float so it can be
-        # hexified properly.
-        sharpen_only_pipe(src_dng_path, raw_prepare_params, temperature_params,
-                          float(amount), f'/tmp/sharpen_amount_{amount}.tif')
+    with darktable_pipe.RenderServer() as server:
+        minimal_pipe(src_dng_path, raw_prepare_params, temperature_params,
+                     '/tmp/minimal_pipe.tif', server=server)
+
+        # colorbalancergb.contrast sweep
+        # Need to cast np.float64 values to Python's native float so they can
+        # be hexified properly.
+        contrasts = [float(c) for c in np.linspace(-0.9, 0.9, 7)]
+        contrast_sweep_pipe(src_dng_path, raw_prepare_params,
+                            temperature_params, contrasts,
+                            [f'/tmp/contrast_{c}.tif' for c in contrasts],
+                            server=server)
+
+        # sharpen.amount sweep
+        amounts = [float(a) for a in np.linspace(0.0, 10.0, 11)]
+        sharpen_sweep_pipe(src_dng_path, raw_prepare_params,
+                           temperature_params, amounts,
+                           [f'/tmp/sharpen_amount_{a}.tif' for a in amounts],
+                           server=server)
 
 
 if __name__ == '__main__':
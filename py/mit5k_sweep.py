@@ -1,6 +1,12 @@
+import argparse
 import numpy as np
 import os
+import shutil
+import tempfile
+import darktable_pipe
 import minimal_pipe_mit5k
+import sweep_scheduler
+import tap_store
 import tmp2tiff
 
 _MIT_5K_ROOT = "/media/shared/data/MIT-Adobe-FiveK/fivek_dataset/raw_photos"
@@ -17,7 +23,7 @@ _DST_ROOT = "/media/shared/data/acr_hyperparams_mit5k_sweep/contrast_sweep"
 # 8 colorbalancergb  *
 # [skip] 9 filmicrgb *
 # 10 colorout
-def convert_tmp2tiff(src_dir, dst_prefix):
+def convert_tmp2tiff(src_dir, dst_prefix, taps=None, src_prefix=''):
     for stage in [
             'temperature_bayer',
             'highlights_bayer',
@@ -29,7 +35,9 @@ def convert_tmp2tiff(src_dir, dst_prefix):
             'colorout'
     ]:
         for suffix in ["in", "out"]:
-            in_file = os.path.join(src_dir, stage) + f'_{suffix}.tmp'
+            if not darktable_pipe.tap_selected(f'{stage}_{suffix}', taps):
+                continue
+            in_file = os.path.join(src_dir, src_prefix + stage) + f'_{suffix}.tmp'
             out_file = f'{dst_prefix}_{stage}_{suffix}.tif'
             print(f"Converting {in_file} -> {out_file}")
             tmp2tiff.tmp2tiff(in_file, out_file)
@@ -42,31 +50,139 @@ def get_sorted_src_paths():
         src_paths.append(os.path.join(dir, file))
   return sorted(src_paths)
 
+def parse_args():
+  parser = argparse.ArgumentParser(description='MIT-5K contrast sweep.')
+  parser.add_argument('--start_idx', type=int, default=0)
+  parser.add_argument('--num_tasks', type=int, default=1000)
+  # Each concurrently running sweep needs its own tap directory, otherwise the
+  # renders overwrite each other's <stage>_{in,out}.tmp files.
+  parser.add_argument('--tap_dir', default=os.environ.get('DT_TAP_DIR', '/tmp'))
+  # Comma-separated DT_TAP_SELECT patterns, e.g. "colorbalancergb". Taps that
+  # are not selected are neither written nor converted. The default, every
+  # tap, makes the server run the whole pipe for every contrast; with only
+  # colorbalancergb and later stages selected it starts from its cache.
+  parser.add_argument('--taps', default=None)
+  # "tiff" has darktable write the final <dst_prefix>_<stage>_<side>.tif files
+  # itself, skipping the .tmp -> .tif conversion pass. "stats" writes
+  # <dst_prefix>_<stage>_<side>.json statistics and histograms instead of
+  # images.
+  parser.add_argument('--tap_format', choices=['tmp', 'tiff', 'stats'], default='tmp')
+  # Number of concurrent renders, each with --cores // --jobs OpenMP threads
+  # on its own CPUs. "auto" measures a few splits on the first image and
+  # picks the fastest.
+  parser.add_argument('--jobs', default='1')
+  parser.add_argument('--cores', type=int, default=sweep_scheduler.available_cores())
+  # Appends a per-module timing trace of every render to this file, see
+  # pipe_trace.py. All slots share it.
+  parser.add_argument('--trace', default=None)
+  # Stores each distinct tap once in this directory, keyed by its content
+  # hash, and writes a <dst_prefix>_taps.json manifest per render instead of
+  # <dst_prefix>_<stage>_<side>.tif copies. The stages before colorbalancergb
+  # are then stored once per image rather than once per contrast.
+  parser.add_argument('--tap_store', default=None)
+  # With --tap_store, deletes the TMP objects once they are converted to
+  # TIFF. Off by default: other renders, e.g. another slot or a later run
+  # with --tap_format tmp, may still link to them.
+  parser.add_argument('--prune', action='store_true')
+  return parser.parse_args()
+
+def sweep_image(server, slot, task):
+  """Renders the pending contrast sweep of one image on `server`.
+
+  task is (index, src_dng_path, args); taps of slot `slot` go to their own
+  subdirectory of args.tap_dir when several slots run at once.
+  """
+  i, src_dng_path, args = task
+  taps = args.taps.split(',') if args.taps is not None else None
+  tap_dir = args.tap_dir if slot is None else os.path.join(args.tap_dir, f'slot{slot}')
+
+  print(f"Reading: {src_dng_path}")
+  base_name = os.path.basename(src_dng_path)
+
+  raw_prepare_params, temperature_params = minimal_pipe_mit5k.read_dng_params(src_dng_path)
+  print(raw_prepare_params, temperature_params)
+
+  contrasts, dst_prefixes, variant_kwargs = [], [], []
+  for contrast in np.linspace(-0.5, 0.9, 7):
+    dst_prefix = f"{_DST_ROOT}/contrast_sweep/{base_name}_contrast=[{contrast:.3f}]"
+    dst_png_path = dst_prefix + ".png"
+
+    if os.path.exists(dst_png_path):
+      print(f"Skipping: {dst_png_path} because it already exists")
+      continue
+    print(f"Processing: index {i:0>5}: {dst_png_path}")
+    contrasts.append(float(contrast))
+    dst_prefixes.append(dst_prefix)
+    # Give every variant its own tap prefix, the batch renders them all
+    # before any conversion.
+    if args.tap_format in ('tiff', 'stats'):
+      variant_kwargs.append(dict(tap_dir=os.path.dirname(dst_prefix), tap_prefix=os.path.basename(dst_prefix) + '_'))
+    else:
+      variant_kwargs.append(dict(tap_dir=tap_dir, tap_prefix=f'{len(contrasts) - 1}_'))
+  if not contrasts:
+    return
+
+  minimal_pipe_mit5k.contrast_sweep_pipe(src_dng_path, raw_prepare_params, temperature_params, contrasts,
+                                         [p + ".png" for p in dst_prefixes], variant_kwargs,
+                                         server=server, taps=taps, tap_format=args.tap_format,
+                                         tap_trace=args.trace, tap_store=args.tap_store)
+  if args.tap_store is not None:
+    tmp_objects = set()
+    for dst_prefix, kwargs in zip(dst_prefixes, variant_kwargs):
+      stored = tap_store.collect(kwargs['tap_dir'], kwargs['tap_prefix'])
+      tmp_objects.update(path for path in stored.values() if path.endswith('.tmp'))
+      stored = {name: tap_store.to_tiff(args.tap_store, path) for name, path in stored.items()}
+      tap_store.write_manifest(dst_prefix + '_taps.json', args.tap_store, stored)
+    if args.prune:
+      for path in tmp_objects:
+        if os.path.exists(path):
+          os.remove(path)
+  elif args.tap_format == 'tmp':
+    for k, dst_prefix in enumerate(dst_prefixes):
+      convert_tmp2tiff(tap_dir, dst_prefix, taps, src_prefix=f'{k}_')
+
+def calibrate(src_dng_path, args):
+  """Picks the number of concurrent renders by timing src_dng_path."""
+  raw_prepare_params, temperature_params = minimal_pipe_mit5k.read_dng_params(src_dng_path)
+  taps = args.taps.split(',') if args.taps is not None else None
+  calibration_dir = tempfile.mkdtemp(prefix='mit5k_sweep_calibration_')
+
+  def render_once(server, slot):
+    slot_dir = os.path.join(calibration_dir, f'slot{slot}')
+    minimal_pipe_mit5k.contrast_only_pipe(src_dng_path, raw_prepare_params, temperature_params, 0.0,
+                                          os.path.join(slot_dir, 'out.png'), server=server,
+                                          tap_dir=slot_dir, taps=taps, tap_format=args.tap_format)
+
+  try:
+    return sweep_scheduler.choose_num_slots(render_once, args.cores)
+  finally:
+    shutil.rmtree(calibration_dir, ignore_errors=True)
+
 def main():
+  args = parse_args()
   src_paths = get_sorted_src_paths()
   # print('basename: ', os.path.basename(src_paths[0]))
 
-  start_idx = 0
-  num_tasks = 1000
-
-  for i in range(start_idx, start_idx + num_tasks):
-    src_dng_path = src_paths[i]
-    print(f"Reading: {src_dng_path}")
-    base_name = os.path.basename(src_dng_path)
-
-    raw_prepare_params, temperature_params = minimal_pipe_mit5k.read_dng_params(src_dng_path)
-    print(raw_prepare_params, temperature_params)
+  start_idx = args.start_idx
+  num_tasks = args.num_tasks
+  tasks = [(i, src_paths[i], args) for i in range(start_idx, min(start_idx + num_tasks, len(src_paths)))]
+  if not tasks:
+    return
 
-    for contrast in np.linspace(-0.5, 0.9, 7):
-      dst_prefix = f"{_DST_ROOT}/contrast_sweep/{base_name}_contrast=[{contrast:.3f}]"
-      dst_png_path = dst_prefix + ".png"
+  if args.jobs == 'auto':
+    num_slots = calibrate(tasks[0][1], args)
+    print(f"Running {num_slots} renders with {args.cores // num_slots} threads each")
+  else:
+    num_slots = int(args.jobs)
 
-      if os.path.exists(dst_png_path):
-        print(f"Skipping: {dst_png_path} because it already exists")
-      else:
-        print(f"Processing: index {i:0>5}: {dst_png_path}")
-        minimal_pipe_mit5k.contrast_only_pipe(src_dng_path, raw_prepare_params, temperature_params, float(contrast), dst_png_path)
-        convert_tmp2tiff('/tmp', dst_prefix)
+  if num_slots == 1:
+    # One server for the whole shard: darktable is initialized once, and each
+    # image is decoded once for all of its contrast values.
+    with darktable_pipe.RenderServer() as server:
+      for task in tasks:
+        sweep_image(server, None, task)
+  else:
+    sweep_scheduler.run(sweep_image, tasks, num_slots, args.cores)
 
 if __name__ == '__main__':
     main()
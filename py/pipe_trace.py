@@ -0,0 +1,115 @@
+# Reads and aggregates the per-render timing traces written with DT_TAP_TRACE.
+#
+# Every render appends JSON lines to the trace: one per process() of a tapped
+# module ("process"), per OpenMP region inside it ("omp"), per tap ("tap" and,
+# with DT_TAP_ASYNC, "tap_write") and a closing "render" line with the totals,
+# see dump_tmp.h and render_server.c. Renders from several servers can share
+# one trace file; their events are told apart by pid.
+#
+#   darktable_pipe.render(src, dst, flags, server=server, tap_trace="t.jsonl")
+#
+#   python pipe_trace.py t.jsonl                     # per-stage summary
+#   python pipe_trace.py t.jsonl --chrome t.json     # for chrome://tracing
+import argparse
+import collections
+import json
+
+
+def read_events(path):
+    with open(path) as f:
+        return [json.loads(line) for line in f if line.strip()]
+
+
+def split_renders(events):
+    """Groups events into renders: a list of (render_event, events) pairs,
+    where events are that process's lines before its render line. Events
+    after a process's last render line are dropped (a render in progress)."""
+    pending = collections.defaultdict(list)
+    renders = []
+    for event in events:
+        if event["cat"] == "render":
+            renders.append((event, pending.pop(event["pid"], [])))
+        else:
+            pending[event["pid"]].append(event)
+    return renders
+
+
+def summarize(renders):
+    """Returns {(cat, name): totals} over all renders, where totals has the
+    count and the summed wall_us, process_cpu_us, heap_delta and bytes.
+    process totals include the module's taps; "self_wall_us" excludes them.
+    process_cpu_us is the whole process's CPU time over the event, so it
+    includes the OpenMP team and anything running alongside."""
+    totals = collections.defaultdict(lambda: collections.Counter())
+    for render, events in renders:
+        taps = collections.Counter()
+        for event in events:
+            if event["cat"] == "tap":
+                taps[event["name"].split("_")[0]] += event["wall_us"]
+        for event in events + [render]:
+            key = (event["cat"], event["name"] if event is not render else "")
+            t = totals[key]
+            t["count"] += 1
+            for field in ("wall_us", "heap_delta", "bytes"):
+                t[field] += event.get(field, 0)
+            # Traces written before the rename call it cpu_us.
+            t["process_cpu_us"] += event.get("process_cpu_us",
+                                             event.get("cpu_us", 0))
+            if event["cat"] == "process":
+                t["self_wall_us"] += event["wall_us"] - taps[event["name"]]
+    return dict(totals)
+
+
+def print_summary(totals):
+    renders = totals.get(("render", ""), {}).get("count", 0) or 1
+    print(f"{renders} renders; mean per render:")
+    print(f'{"cat":<10}{"name":<28}{"wall ms":>10}{"self ms":>10}'
+          f'{"proc cpu ms":>12}{"cpu/wall":>10}{"MB":>10}')
+    order = {"render": 0, "process": 1, "omp": 2, "tap": 3, "tap_write": 4}
+    for (cat, name), t in sorted(totals.items(),
+                                 key=lambda kv: (order.get(kv[0][0], 5),
+                                                 -kv[1]["wall_us"])):
+        wall = t["wall_us"] / renders / 1e3
+        cpu = t["process_cpu_us"] / renders / 1e3
+        self_wall = (f'{t["self_wall_us"] / renders / 1e3:>10.1f}'
+                     if cat == "process" else f'{"":>10}')
+        print(f'{cat:<10}{name:<28}{wall:>10.1f}{self_wall}{cpu:>12.1f}'
+              f'{cpu / wall if wall else 0:>10.2f}'
+              f'{t["bytes"] / renders / 2**20:>10.1f}')
+
+
+def to_chrome_trace(events):
+    """Converts trace events to the Chrome trace event format ("X" complete
+    events), for chrome://tracing or Perfetto."""
+    trace = []
+    for event in events:
+        args = {k: v for k, v in event.items()
+                if k not in ("cat", "name", "pid", "tid", "ts_us", "wall_us")}
+        trace.append({
+            "name": event["name"],
+            "cat": event["cat"],
+            "ph": "X",
+            "pid": event["pid"],
+            "tid": event.get("tid", 0),
+            "ts": event["ts_us"],
+            "dur": event["wall_us"],
+            "args": args
+        })
+    return {"traceEvents": trace, "displayTimeUnit": "ms"}
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Summarize DT_TAP_TRACE traces.")
+    parser.add_argument("traces", nargs="+")
+    parser.add_argument("--chrome", help="also write a Chrome trace here")
+    args = parser.parse_args()
+
+    events = [e for path in args.traces for e in read_events(path)]
+    print_summary(summarize(split_renders(events)))
+    if args.chrome:
+        with open(args.chrome, "w") as f:
+            json.dump(to_chrome_trace(events), f)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,127 @@
+# Runs many darktable renders concurrently, each on its own share of the cores.
+#
+# A single render does not scale to a big machine: demosaic, the tap-outs and
+# every module's serial setup leave most of 64 threads idle. Splitting the
+# cores into K slots of cores // K threads and keeping K renders in flight
+# gets far more renders per second. Each slot is a RenderServer pinned to its
+# cores with OMP_NUM_THREADS set to match.
+#
+# K is best measured, not guessed: choose_num_slots() renders the same image
+# concurrently for a few candidate K and keeps the one with the highest
+# throughput.
+import concurrent.futures
+import multiprocessing
+import os
+import time
+
+import darktable_pipe
+
+
+def available_cores():
+    return len(os.sched_getaffinity(0))
+
+
+def slot_cpus(slot, num_slots, cores):
+    """The CPUs slot `slot` of `num_slots` is pinned to, out of the first
+    `cores` CPUs this process may run on."""
+    cpus = sorted(os.sched_getaffinity(0))[:cores]
+    if num_slots > len(cpus):
+        # Oversubscribed: share the CPUs round-robin.
+        return [cpus[slot % len(cpus)]]
+    n = len(cpus) // num_slots
+    return cpus[slot * n:(slot + 1) * n]
+
+
+def start_server(slot, num_slots, cores):
+    cpus = slot_cpus(slot, num_slots, cores)
+    env = dict(os.environ, OMP_NUM_THREADS=str(len(cpus)))
+    return darktable_pipe.RenderServer(env=env, cpus=cpus)
+
+
+def measure_throughput(render_once, num_slots, cores, reps=2):
+    """Returns renders per second with num_slots concurrent servers.
+
+    render_once(server, slot) renders one representative image. Each server
+    renders once untimed first, so that start-up and decode are not counted.
+    """
+    servers = [start_server(s, num_slots, cores) for s in range(num_slots)]
+    try:
+        with concurrent.futures.ThreadPoolExecutor(num_slots) as pool:
+
+            def run(reps):
+                futures = [
+                    pool.submit(lambda s: [
+                        render_once(servers[s], s) for _ in range(reps)
+                    ], s) for s in range(num_slots)
+                ]
+                for f in futures:
+                    f.result()
+
+            run(1)
+            start = time.perf_counter()
+            run(reps)
+            return num_slots * reps / (time.perf_counter() - start)
+    finally:
+        for server in servers:
+            server.close()
+
+
+def choose_num_slots(render_once, cores=None, candidates=None, max_slots=16):
+    """Measures throughput for each candidate number of slots and returns the
+    fastest. Candidates default to powers of two up to max_slots (every
+    server keeps a decoded raw and its pipe cache in memory)."""
+    cores = cores or available_cores()
+    if candidates is None:
+        candidates = [
+            k for k in (2**i for i in range(cores.bit_length()))
+            if k <= min(cores, max_slots)
+        ]
+
+    throughput = {}
+    for k in candidates:
+        throughput[k] = measure_throughput(render_once, k, cores)
+        # One render on cores // k threads takes k / throughput seconds; the
+        # speedup is how much better that uses the cores than the first
+        # candidate's split.
+        speedup = throughput[k] / throughput[candidates[0]]
+        print(f'{k:>3} x {cores // k:>3} threads: '
+              f'{k / throughput[k]:.2f} s/render, '
+              f'{throughput[k]:.3f} renders/s, speedup {speedup:.2f}')
+    return max(throughput, key=throughput.get)
+
+
+# Set in each worker process by _init_worker().
+_worker_slot = None
+_worker_server = None
+
+
+def _init_worker(slots, num_slots, cores):
+    global _worker_slot, _worker_server
+    _worker_slot = slots.get()
+    # The server exits on its own when this process goes away and closes its
+    # stdin.
+    _worker_server = start_server(_worker_slot, num_slots, cores)
+
+
+def _run_task(work, task):
+    return work(_worker_server, _worker_slot, task)
+
+
+def run(work, tasks, num_slots, cores=None):
+    """Calls work(server, slot, task) for every task, num_slots at a time.
+
+    Every slot is a worker process with its own RenderServer on cores //
+    num_slots pinned CPUs. work must be picklable (a module-level function)
+    and should keep per-slot state, e.g. its tap directory, apart by slot.
+    Returns the results in task order.
+    """
+    cores = cores or available_cores()
+    ctx = multiprocessing.get_context('fork')
+    slots = ctx.Queue()
+    for s in range(num_slots):
+        slots.put(s)
+    with concurrent.futures.ProcessPoolExecutor(
+            num_slots, mp_context=ctx, initializer=_init_worker,
+            initargs=(slots, num_slots, cores)) as pool:
+        futures = [pool.submit(_run_task, work, task) for task in tasks]
+        return [f.result() for f in futures]
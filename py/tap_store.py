@@ -0,0 +1,75 @@
+# Per-render manifests for the content-addressed tap store.
+#
+# With DT_TAP_STORE=<store> (darktable_pipe.render(..., tap_store=<store>)),
+# darktable writes every distinct tap once, to <store>/<hh>/<sha256>.tmp (or
+# .tif), and leaves a symlink to it at the usual tap path, see dump_tmp.h.
+# In a sweep, the stages upstream of the swept module produce the same bytes
+# for every variant, so they are stored once per image instead of once per
+# variant.
+#
+# After a render, collect() replaces its symlinks by a manifest:
+#
+#   {"store": "<store>", "taps": {"sharpen_in": "ab/ab12...ef.tmp", ...}}
+#
+# and read_manifest() maps the tap names back to object paths.
+import glob
+import json
+import os
+
+import tmp2tiff
+
+_TAP_EXTENSIONS = (".tmp", ".tif")
+
+
+def collect(tap_dir, tap_prefix=""):
+    """Returns {tap name: object path} for the store symlinks
+    <tap_dir>/<tap_prefix><tap>.{tmp,tif} and removes the symlinks."""
+    taps = {}
+    prefix = os.path.join(tap_dir, tap_prefix)
+    for path in glob.glob(glob.escape(prefix) + "*"):
+        name, extension = os.path.splitext(path[len(prefix):])
+        if extension not in _TAP_EXTENSIONS or not os.path.islink(path):
+            continue
+        taps[name] = os.readlink(path)
+        os.unlink(path)
+    return taps
+
+
+def to_tiff(store, object_path):
+    """Returns the TIFF object for a tap object: the object itself if it is a
+    TIFF, otherwise <store>/<hh>/<sha256>.tif converted from the TMP object by
+    tmp2tiff() once and reused afterwards. TMP and TIFF taps are hashed with
+    their format, so a converted object never collides with a TIFF tap."""
+    stem, extension = os.path.splitext(object_path)
+    if extension == ".tif":
+        return object_path
+    tiff_path = stem + ".tif"
+    if not os.path.exists(tiff_path):
+        part = f"{tiff_path}.part-{os.getpid()}"
+        tmp2tiff.tmp2tiff(object_path, part)
+        os.replace(part, tiff_path)
+    return tiff_path
+
+
+def write_manifest(manifest_path, store, taps):
+    """Writes the manifest for taps ({tap name: object path})."""
+    store = os.path.abspath(store)
+    manifest = {
+        "store": store,
+        "taps": {
+            name: os.path.relpath(path, store)
+            for name, path in sorted(taps.items())
+        }
+    }
+    with open(manifest_path, "w") as f:
+        json.dump(manifest, f, indent=1)
+
+
+def read_manifest(manifest_path):
+    """Returns {tap name: object path} for a manifest."""
+    with open(manifest_path) as f:
+        manifest = json.load(f)
+    return {
+        name: os.path.join(manifest["store"], path)
+        for name, path in manifest["taps"].items()
+    }
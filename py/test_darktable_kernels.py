@@ -0,0 +1,142 @@
+# Runs every module of darktable_kernels.MODULES on a small buffer whose
+# output is known in closed form: a scaling, a clip, the Lab lightness of
+# greys, or a fixed point of the tone curve.
+#
+#   python -m unittest test_darktable_kernels
+#
+# Skipped without libdarktable_kernels (see DT_KERNELS_LIB).
+import os
+import struct
+import unittest
+
+import numpy as np
+
+import darktable_kernels
+import darktable_pipe
+
+# DT_COLORSPACE_LIN_REC2020 in common/colorspaces.h.
+_LIN_REC2020 = 4
+# DT_IOP_COLOR_ICC_LEN in colorin.c and colorout.c.
+_ICC_LEN = 512
+
+
+def _colorin_params(profile):
+    # dt_iop_colorin_params_t: type, filename, intent, normalize,
+    # blue_mapping, type_work, filename_work.
+    return struct.pack(f"<i{_ICC_LEN}s4i{_ICC_LEN}s", profile, b"", 0, 0, 0,
+                       _LIN_REC2020, b"")
+
+
+def _colorout_params(profile):
+    # dt_iop_colorout_params_t: type, filename, intent.
+    return struct.pack(f"<i{_ICC_LEN}si", profile, b"", 0)
+
+
+def _rgb(height=8, width=12, seed=0):
+    rng = np.random.default_rng(seed)
+    return rng.uniform(0.05, 0.9, (height, width, 3)).astype(np.float32)
+
+
+def _greys(height=8, width=12):
+    row = np.linspace(0.05, 0.9, width, dtype=np.float32)
+    return np.tile(row, (height, 1))
+
+
+def _grey_rgb(luminance):
+    return np.repeat(luminance[..., np.newaxis], 3, axis=-1)
+
+
+def _lightness(luminance):
+    # CIE L* of a luminance above (6/29)^3, relative to white.
+    return 116.0 * np.cbrt(luminance) - 16.0
+
+
+@unittest.skipUnless(os.path.exists(darktable_kernels._KERNELS_LIB),
+                     "needs libdarktable_kernels")
+class KernelsTest(unittest.TestCase):
+
+    @classmethod
+    def setUpClass(cls):
+        # darktable keeps global state: one Kernels for the whole process.
+        cls.kernels = darktable_kernels.Kernels()
+
+    def test_every_module_is_tested(self):
+        tested = {
+            name[len("test_"):].split("_")[0]
+            for name in dir(self)
+            if name.startswith("test_")
+        }
+        self.assertLessEqual(set(darktable_kernels.MODULES), tested)
+
+    def test_temperature(self):
+        image = _rgb()
+        params = darktable_pipe.TemperatureParams(red=2.0, green=1.0,
+                                                  blue=0.5)
+        out = self.kernels.temperature(image, params)
+        np.testing.assert_allclose(out, image * [2.0, 1.0, 0.5], rtol=1e-6)
+
+    def test_temperature_mosaic(self):
+        mosaic = np.ones((8, 12), np.float32)
+        params = darktable_pipe.TemperatureParams(red=2.0, green=1.0,
+                                                  blue=0.5)
+        out = self.kernels.temperature(mosaic, params,
+                                       darktable_kernels.FILTERS_RGGB)
+        np.testing.assert_allclose(out[0::2, 0::2], 2.0)
+        np.testing.assert_allclose(out[0::2, 1::2], 1.0)
+        np.testing.assert_allclose(out[1::2, 0::2], 1.0)
+        np.testing.assert_allclose(out[1::2, 1::2], 0.5)
+
+    def test_highlights(self):
+        image = _rgb()
+        out = self.kernels.highlights(image,
+                                      darktable_pipe.HighlightsParams(clip=0.5))
+        np.testing.assert_allclose(out, np.minimum(image, 0.5))
+
+    def test_exposure(self):
+        image = _rgb()
+        out = self.kernels.exposure(image,
+                                    darktable_pipe.ExposureParams(exposure=1.0))
+        np.testing.assert_allclose(out, 2.0 * image, rtol=1e-6)
+
+    def test_colorin(self):
+        # colorin's output is Lab: linear Rec2020 greys have a = b = 0 and
+        # the CIE lightness of their luminance.
+        luminance = _greys()
+        out = self.kernels.colorin(_grey_rgb(luminance),
+                                   _colorin_params(_LIN_REC2020))
+        np.testing.assert_allclose(out[..., 0], _lightness(luminance),
+                                   atol=0.05)
+        np.testing.assert_allclose(out[..., 1:], 0.0, atol=0.05)
+
+    def test_sharpen(self):
+        # Nothing to sharpen in a flat image.
+        image = np.full((32, 32, 3), 0.3, np.float32)
+        out = self.kernels.sharpen(image,
+                                   darktable_pipe.SharpenParams(amount=2.0))
+        np.testing.assert_allclose(out, image, atol=1e-6)
+
+    def test_colorbalancergb(self):
+        # The defaults leave greys alone.
+        image = _grey_rgb(_greys())
+        out = self.kernels.colorbalancergb(image)
+        np.testing.assert_allclose(out, image, atol=1e-3)
+
+    def test_filmicrgb(self):
+        # The tone curve maps the grey point source to the grey point target.
+        image = np.full((8, 12, 3), 0.1845, np.float32)
+        params = darktable_pipe.FilmicRGBParams(preserve_color=0)
+        out = self.kernels.filmicrgb(image, params)
+        np.testing.assert_allclose(out, 0.1845, atol=2e-3)
+
+    def test_colorout(self):
+        # colorout's input is Lab: greys come out of linear Rec2020 with
+        # r = g = b = their luminance.
+        luminance = _greys()
+        lab = np.zeros(luminance.shape + (3,), np.float32)
+        lab[..., 0] = _lightness(luminance)
+        out = self.kernels.colorout(lab, _colorout_params(_LIN_REC2020))
+        np.testing.assert_allclose(out, _grey_rgb(luminance), atol=1e-3)
+
+
+if __name__ == "__main__":
+    unittest.main()
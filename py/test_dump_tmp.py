@@ -0,0 +1,241 @@
+# Writes a synthetic buffer through every tap writer of dump_tmp.h, with the
+# dump-tmp-test helper (darktable/src/cli/dump_tmp_test.c), and reads it back
+# with loadTMP() and mmapTMP().
+#
+#   python -m unittest test_dump_tmp
+#
+# Skipped without dump-tmp-test (see DT_DUMP_TMP_TEST). No darktable binary,
+# raw or pipe is involved.
+import json
+import os
+import shutil
+import subprocess
+import tempfile
+import unittest
+
+import numpy as np
+
+import darktable_pipe
+import loadTMP
+
+# dump-tmp-test is installed next to libdarktable_kernels.
+_DUMP_TMP_TEST = os.environ.get(
+    "DT_DUMP_TMP_TEST",
+    os.path.join(os.path.dirname(darktable_pipe._DARKTABLE_CLI), "..", "lib",
+                 "darktable", "dump-tmp-test"))
+
+# Not a multiple of the band rows below, so the last band is short.
+_WIDTH, _HEIGHT, _CHANNELS = 37, 23, 4
+
+
+def ramp(width=_WIDTH, height=_HEIGHT, channels=_CHANNELS):
+    """The buffer dump-tmp-test writes, as (height, width, channels)."""
+    n = width * height * channels
+    return (np.arange(n, dtype=np.float32) / np.float32(n)).reshape(
+        height, width, channels)
+
+
+@unittest.skipUnless(os.path.exists(_DUMP_TMP_TEST), "needs dump-tmp-test")
+class DumpTmpTestCase(unittest.TestCase):
+    """Runs dump-tmp-test in a fresh tap directory."""
+
+    def setUp(self):
+        self.tap_dir = tempfile.mkdtemp(prefix="dump_tmp_test_")
+        self.addCleanup(shutil.rmtree, self.tap_dir)
+
+    def write(self, taps=("test_out",), width=_WIDTH, height=_HEIGHT,
+              channels=_CHANNELS, cwd=None, **env):
+        """Writes the ramp to every tap in taps, with env added to a clean
+        tap environment. Returns the tap directory."""
+        full_env = {
+            k: v for k, v in os.environ.items()
+            if not k.startswith(("DT_TAP_", "DT_TMP_"))
+        }
+        full_env.update(env, DT_TAP_DIR=self.tap_dir)
+        subprocess.run([_DUMP_TMP_TEST, str(width), str(height),
+                        str(channels), *taps], env=full_env, cwd=cwd,
+                       check=True)
+        return self.tap_dir
+
+    def path(self, name):
+        return os.path.join(self.tap_dir, name)
+
+
+class FormatsTest(DumpTmpTestCase):
+
+    def check(self, path, atol=0.0, dtype=np.float32):
+        expected = ramp()[np.newaxis]
+        a = loadTMP.loadTMP(path)
+        self.assertEqual(a.shape, expected.shape)
+        self.assertEqual(a.dtype, dtype)
+        np.testing.assert_allclose(a, expected, rtol=0, atol=atol)
+
+        view = loadTMP.mmapTMP(path)
+        self.assertEqual(view.shape, expected.shape)
+        np.testing.assert_allclose(view[0, 7:13, 2:30:3, 1:3],
+                                   expected[0, 7:13, 2:30:3, 1:3],
+                                   rtol=0, atol=atol)
+        np.testing.assert_allclose(np.asarray(view), expected, rtol=0,
+                                   atol=atol)
+
+    def test_planar(self):
+        self.write()
+        self.check(self.path("test_out.tmp"))
+
+    def test_interleaved(self):
+        self.write(DT_TMP_LAYOUT="interleaved")
+        self.check(self.path("test_out.tmp"))
+
+    def test_float16(self):
+        self.write(DT_TMP_ENCODING="float16")
+        self.check(self.path("test_out.tmp"), atol=5e-4, dtype=np.float16)
+
+    def test_uint16(self):
+        self.write(DT_TMP_ENCODING="uint16")
+        self.check(self.path("test_out.tmp"), atol=1.0 / 65535)
+
+    def test_encoding_per_tap(self):
+        self.write(("test_in", "test_out"),
+                   DT_TMP_ENCODING="float16,test_out=float32")
+        self.assertEqual(loadTMP.loadTMP(self.path("test_in.tmp")).dtype,
+                         np.float16)
+        self.check(self.path("test_out.tmp"))
+
+    def test_deflate(self):
+        for layout in ("planar", "interleaved"):
+            with self.subTest(layout=layout):
+                self.write(DT_TMP_LAYOUT=layout, DT_TMP_COMPRESSION="deflate",
+                           DT_TMP_BAND_ROWS="5")
+                path = self.path("test_out.tmp")
+                self.check(path)
+                np.testing.assert_array_equal(
+                    loadTMP.loadTMP(path, rows=(7, 13)), ramp()[np.newaxis, 7:13])
+
+    def test_deflate_float16(self):
+        self.write(DT_TMP_COMPRESSION="deflate:6", DT_TMP_ENCODING="float16")
+        self.check(self.path("test_out.tmp"), atol=5e-4, dtype=np.float16)
+
+    def test_async(self):
+        self.write(("test_in", "test_out"), DT_TAP_ASYNC="1")
+        self.check(self.path("test_in.tmp"))
+        self.check(self.path("test_out.tmp"))
+
+    def test_prefix(self):
+        self.write(DT_TAP_PREFIX="3_")
+        self.check(self.path("3_test_out.tmp"))
+
+    def test_tiff(self):
+        try:
+            import tifffile
+        except ImportError:
+            self.skipTest("needs tifffile")
+        self.write(DT_TAP_FORMAT="tiff")
+        a = tifffile.imread(self.path("test_out.tif"))
+        self.assertEqual(a.dtype, np.float32)
+        np.testing.assert_array_equal(a, ramp()[..., :3])
+
+
+def tent_downsample(image, f):
+    """DT_TAP_DOWNSAMPLE_FILTER=bilinear: each output pixel is the mean of
+    the inputs within one output pixel of its center, weighted by
+    1 - distance / f along each axis."""
+    height, width, _ = image.shape
+
+    def weights(n, out_n):
+        centers = (np.arange(out_n) + 0.5) * f
+        w = 1 - np.abs(np.arange(n) + 0.5 - centers[:, np.newaxis]) / f
+        w = np.maximum(w, 0)
+        return w / w.sum(axis=1, keepdims=True)
+
+    wy = weights(height, height // f)
+    wx = weights(width, width // f)
+    return np.einsum("yi,xj,ijc->yxc", wy, wx, image.astype(np.float64))
+
+
+class ReduceTest(DumpTmpTestCase):
+
+    def load(self, **env):
+        self.write(**env)
+        return loadTMP.loadTMP(self.path("test_out.tmp"))[0]
+
+    def test_crop(self):
+        a = self.load(DT_TAP_CROP="3,4,10,7")
+        np.testing.assert_array_equal(a, ramp()[4:11, 3:13])
+
+    def test_box(self):
+        a = self.load(DT_TAP_DOWNSAMPLE="3")
+        image = ramp()[:_HEIGHT // 3 * 3, :_WIDTH // 3 * 3]
+        expected = image.reshape(_HEIGHT // 3, 3, _WIDTH // 3, 3,
+                                 _CHANNELS).mean(axis=(1, 3))
+        np.testing.assert_allclose(a, expected, rtol=0, atol=1e-6)
+
+    def test_bilinear(self):
+        for f in (2, 3, 4):
+            with self.subTest(factor=f):
+                a = self.load(DT_TAP_DOWNSAMPLE=str(f),
+                              DT_TAP_DOWNSAMPLE_FILTER="bilinear")
+                np.testing.assert_allclose(a, tent_downsample(ramp(), f),
+                                           rtol=0, atol=1e-6)
+
+    def test_mosaic(self):
+        # Each output sample averages f x f samples of its own CFA color.
+        a = self.load(channels=1, DT_TAP_DOWNSAMPLE="2")[..., 0]
+        self.assertEqual(a.shape, (_HEIGHT // 4 * 2, _WIDTH // 4 * 2))
+        image = ramp(channels=1)[..., 0]
+        for py in (0, 1):
+            for px in (0, 1):
+                out = a[py::2, px::2]
+                same = image[py::2, px::2][:out.shape[0] * 2, :out.shape[1] * 2]
+                expected = same.reshape(out.shape[0], 2, out.shape[1],
+                                        2).mean(axis=(1, 3))
+                np.testing.assert_allclose(out, expected, rtol=0, atol=1e-6)
+
+
+class StatsTest(DumpTmpTestCase):
+
+    def stats(self, channels=_CHANNELS, bins=64):
+        self.write(channels=channels, DT_TAP_FORMAT="stats",
+                   DT_TAP_STATS_BINS=str(bins))
+        with open(self.path("test_out.json")) as f:
+            return json.load(f)
+
+    def test_stats(self):
+        bins = 64
+        stats = self.stats(bins=bins)
+        image = ramp().reshape(-1, _CHANNELS)
+        self.assertEqual((stats["width"], stats["height"], stats["bins"]),
+                         (_WIDTH, _HEIGHT, bins))
+        self.assertEqual(stats["channels"], _CHANNELS)
+        self.assertEqual(len(stats["stats"]), _CHANNELS)
+        for c, s in enumerate(stats["stats"]):
+            with self.subTest(channel=c):
+                samples = image[:, c].astype(np.float64)
+                self.assertAlmostEqual(s["min"], samples.min(), places=6)
+                self.assertAlmostEqual(s["max"], samples.max(), places=6)
+                self.assertAlmostEqual(s["mean"], samples.mean(), places=6)
+                self.assertAlmostEqual(s["std"], samples.std(), places=5)
+                self.assertEqual(s["nonfinite"], 0)
+                self.assertEqual(len(s["histogram"]), bins)
+                self.assertEqual(sum(s["histogram"]), len(samples))
+                # A ramp fills the bins evenly.
+                self.assertLessEqual(np.ptp(s["histogram"]), 1)
+                bin_width = (samples.max() - samples.min()) / bins
+                for p, value in s["percentiles"].items():
+                    self.assertAlmostEqual(
+                        value, np.percentile(samples, float(p)),
+                        delta=bin_width, msg=p)
+
+    def test_channels_are_the_summarised_ones(self):
+        stats = self.stats(channels=5)
+        self.assertEqual(stats["channels"], 4)
+        self.assertEqual(len(stats["stats"]), 4)
+
+    def test_mosaic(self):
+        stats = self.stats(channels=1)
+        self.assertEqual(stats["channels"], 1)
+        self.assertAlmostEqual(stats["stats"][0]["mean"],
+                               ramp(channels=1).mean(), places=6)
+
+
+if __name__ == "__main__":
+    unittest.main()
@@ -0,0 +1,109 @@
+# Reads TMP files written here in Python, following the layouts dump_tmp.h
+# writes (see the DT_TMP_* defines and dump_tmp_compressed()), with loadTMP()
+# and mmapTMP(). test_dump_tmp.py checks the C writers themselves.
+#
+#   python -m unittest test_loadTMP
+import os
+import shutil
+import struct
+import tempfile
+import unittest
+import zlib
+
+import numpy as np
+
+import loadTMP
+
+_TYPE_CODES = {np.float32: 0, np.uint16: 4, np.float16: 10}
+
+
+def write_tmp(path, image, dtype=np.float32, interleaved=False,
+              normalized=False, band_rows=None):
+    """Writes image, (height, width, channels) float, as a single-frame TMP
+    file; band_rows compresses it like DT_TMP_COMPRESSION=deflate."""
+    height, width, channels = image.shape
+    if normalized:
+        samples = np.round(np.clip(image, 0, 1) * 65535).astype(dtype)
+    else:
+        samples = image.astype(dtype)
+    type_code = _TYPE_CODES[dtype]
+    type_code |= interleaved * loadTMP._FLAG_INTERLEAVED
+    type_code |= normalized * loadTMP._FLAG_NORMALIZED
+    type_code |= (band_rows is not None) * loadTMP._FLAG_DEFLATE
+    # One plane per channel, or a single one of whole pixels.
+    planes = [samples] if interleaved else \
+        [samples[..., c] for c in range(channels)]
+
+    with open(path, "wb") as f:
+        f.write(struct.pack("<5i", width, height, 1, channels, type_code))
+        if band_rows is None:
+            for plane in planes:
+                f.write(np.ascontiguousarray(plane).tobytes())
+            return
+        blobs = [
+            zlib.compress(np.ascontiguousarray(plane[y:y + band_rows]).tobytes())
+            for plane in planes for y in range(0, height, band_rows)
+        ]
+        f.write(struct.pack("<2i", band_rows, len(blobs)))
+        offset = loadTMP._HEADER_SIZE + 8 + 8 * (len(blobs) + 1)
+        offsets = np.cumsum([offset] + [len(b) for b in blobs], dtype=np.uint64)
+        f.write(offsets.tobytes())
+        for blob in blobs:
+            f.write(blob)
+
+
+def _image(height=23, width=37, channels=3):
+    rng = np.random.default_rng(0)
+    return rng.random((height, width, channels), dtype=np.float32)
+
+
+class LoadTMPTest(unittest.TestCase):
+
+    def setUp(self):
+        self.dir = tempfile.mkdtemp(prefix="loadTMP_test_")
+        self.addCleanup(shutil.rmtree, self.dir)
+        self.path = os.path.join(self.dir, "tap.tmp")
+        self.image = _image()
+
+    def check(self, atol=0.0, **kwargs):
+        write_tmp(self.path, self.image, **kwargs)
+        expected = self.image[np.newaxis]
+        np.testing.assert_allclose(loadTMP.loadTMP(self.path), expected,
+                                   rtol=0, atol=atol)
+        np.testing.assert_allclose(loadTMP.loadTMP(self.path, rows=(5, 17)),
+                                   expected[:, 5:17], rtol=0, atol=atol)
+
+        view = loadTMP.mmapTMP(self.path)
+        self.assertEqual(view.shape, expected.shape)
+        for key in (np.s_[0, 5:17, :, 1:], np.s_[:, 3], np.s_[0, [2, 9, 4]],
+                    np.s_[..., 0], np.s_[0, ::-1]):
+            np.testing.assert_allclose(view[key], expected[key], rtol=0,
+                                       atol=atol, err_msg=str(key))
+
+    def test_planar(self):
+        self.check()
+
+    def test_interleaved(self):
+        self.check(interleaved=True)
+
+    def test_float16(self):
+        self.check(atol=5e-4, dtype=np.float16)
+
+    def test_normalized_uint16(self):
+        write_tmp(self.path, self.image, dtype=np.uint16, normalized=True)
+        self.assertEqual(loadTMP.loadTMP(self.path).dtype, np.float32)
+        self.assertEqual(loadTMP.mmapTMP(self.path).dtype, np.float32)
+        self.check(atol=0.5 / 65535, dtype=np.uint16, normalized=True)
+
+    def test_deflate(self):
+        for interleaved in (False, True):
+            for band_rows in (1, 5, 64):
+                with self.subTest(interleaved=interleaved, band_rows=band_rows):
+                    self.check(interleaved=interleaved, band_rows=band_rows)
+
+    def test_deflate_float16(self):
+        self.check(atol=5e-4, dtype=np.float16, band_rows=4)
+
+
+if __name__ == "__main__":
+    unittest.main()
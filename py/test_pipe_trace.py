@@ -0,0 +1,107 @@
+# pipe_trace.py on hand-written traces, and, with the dump-tmp-test helper,
+# on the tap events dump_tmp() appends to DT_TAP_TRACE.
+#
+#   python -m unittest test_pipe_trace
+import json
+import os
+import shutil
+import tempfile
+import unittest
+
+import pipe_trace
+from test_dump_tmp import DumpTmpTestCase, ramp
+
+
+def _event(cat, name, pid=1, ts_us=0, wall_us=10, process_cpu_us=20,
+           **fields):
+    return dict(cat=cat, name=name, pid=pid, ts_us=ts_us, wall_us=wall_us,
+                process_cpu_us=process_cpu_us, **fields)
+
+
+class PipeTraceTest(unittest.TestCase):
+
+    def test_split_renders(self):
+        events = [
+            _event("process", "sharpen", pid=1),
+            _event("process", "exposure", pid=2),
+            _event("render", "a.png", pid=1),
+            _event("tap", "exposure_out", pid=2),
+            _event("render", "b.png", pid=2),
+            # A render still in progress.
+            _event("process", "sharpen", pid=1),
+        ]
+        renders = pipe_trace.split_renders(events)
+        self.assertEqual([(r["name"], [e["name"] for e in evs])
+                          for r, evs in renders],
+                         [("a.png", ["sharpen"]),
+                          ("b.png", ["exposure", "exposure_out"])])
+
+    def test_summarize(self):
+        events = []
+        for _ in range(2):
+            events += [
+                _event("tap", "sharpen_in", wall_us=3, bytes=100),
+                _event("tap", "sharpen_out", wall_us=4, bytes=100),
+                _event("omp", "sharpen.blur", wall_us=5),
+                _event("process", "sharpen", wall_us=20, heap_delta=8,
+                       bytes=200),
+                _event("render", "out.png", wall_us=50, process_cpu_us=80),
+            ]
+        totals = pipe_trace.summarize(pipe_trace.split_renders(events))
+        sharpen = totals[("process", "sharpen")]
+        self.assertEqual(sharpen["count"], 2)
+        self.assertEqual(sharpen["wall_us"], 40)
+        # The taps are part of process() but not of its own work.
+        self.assertEqual(sharpen["self_wall_us"], 2 * (20 - 3 - 4))
+        self.assertEqual(sharpen["process_cpu_us"], 40)
+        self.assertEqual(sharpen["heap_delta"], 16)
+        self.assertEqual(sharpen["bytes"], 400)
+        self.assertEqual(totals[("render", "")]["process_cpu_us"], 160)
+        self.assertEqual(totals[("tap", "sharpen_out")]["bytes"], 200)
+
+    def test_summarize_reads_cpu_us(self):
+        # Traces written before process_cpu_us.
+        old = dict(_event("process", "sharpen"), cpu_us=7)
+        del old["process_cpu_us"]
+        totals = pipe_trace.summarize(
+            pipe_trace.split_renders([old, _event("render", "out.png")]))
+        self.assertEqual(totals[("process", "sharpen")]["process_cpu_us"], 7)
+
+    def test_chrome_trace(self):
+        event = _event("process", "sharpen", ts_us=100, wall_us=20, tid=3,
+                       bytes=64)
+        trace = pipe_trace.to_chrome_trace([event])
+        self.assertEqual(trace["traceEvents"], [{
+            "name": "sharpen", "cat": "process", "ph": "X", "pid": 1,
+            "tid": 3, "ts": 100, "dur": 20,
+            "args": {"process_cpu_us": 20, "bytes": 64}
+        }])
+
+    def test_read_events(self):
+        tmp = tempfile.mkdtemp(prefix="pipe_trace_test_")
+        self.addCleanup(shutil.rmtree, tmp)
+        path = os.path.join(tmp, "trace.jsonl")
+        events = [_event("process", "sharpen"), _event("render", "out.png")]
+        with open(path, "w") as f:
+            f.write("".join(json.dumps(e) + "\n" for e in events) + "\n")
+        self.assertEqual(pipe_trace.read_events(path), events)
+
+
+class TapTraceTest(DumpTmpTestCase):
+
+    def test_tap_events(self):
+        trace = self.path("trace.jsonl")
+        self.write(("a_in", "a_out"), DT_TAP_TRACE=trace)
+        # A second process appends to the same trace.
+        self.write(("a_out",), DT_TAP_TRACE=trace, DT_TAP_PREFIX="1_")
+        events = pipe_trace.read_events(trace)
+        self.assertEqual([(e["cat"], e["name"]) for e in events],
+                         [("tap", "a_in"), ("tap", "a_out"), ("tap", "a_out")])
+        for e in events:
+            self.assertGreaterEqual(e["wall_us"], 0)
+            self.assertGreaterEqual(e["process_cpu_us"], 0)
+            self.assertEqual(e["bytes"], ramp().nbytes)
+
+
+if __name__ == "__main__":
+    unittest.main()
@@ -0,0 +1,74 @@
+# Checks that every variant of a held-raw batch writes the same taps as the
+# first one, although the server's pipe cache serves the upstream modules of
+# every variant after the first (see render_server.c).
+#
+#   DT_TEST_DNG=/path/to/raw.dng python -m unittest test_render_batch_taps
+#
+# Skipped without DT_TEST_DNG, rawpy or a darktable-render-server binary.
+import glob
+import os
+import shutil
+import tempfile
+import unittest
+
+import darktable_pipe
+
+try:
+    import minimal_pipe_mit5k
+except ImportError:  # rawpy
+    minimal_pipe_mit5k = None
+
+_TEST_DNG = os.environ.get("DT_TEST_DNG")
+
+
+def _taps(tap_dir, prefix):
+    return sorted(
+        os.path.basename(path)[len(prefix):]
+        for path in glob.glob(os.path.join(tap_dir, glob.escape(prefix) + "*")))
+
+
+@unittest.skipUnless(
+    _TEST_DNG and minimal_pipe_mit5k and
+    os.path.exists(darktable_pipe._DARKTABLE_RENDER_SERVER),
+    "needs DT_TEST_DNG, rawpy and darktable-render-server")
+class RenderBatchTapsTest(unittest.TestCase):
+
+    def setUp(self):
+        self.tap_dir = tempfile.mkdtemp(prefix="render_batch_taps_")
+        self.addCleanup(shutil.rmtree, self.tap_dir)
+        self.params = minimal_pipe_mit5k.read_dng_params(_TEST_DNG)
+
+    def render_contrast_sweep(self, **tap_kwargs):
+        contrasts = [-0.5, 0.5]
+        outputs = [
+            os.path.join(self.tap_dir, f"out_{k}.tif")
+            for k in range(len(contrasts))
+        ]
+        variant_kwargs = [{"tap_prefix": f"{k}_"} for k in range(len(contrasts))]
+        with darktable_pipe.RenderServer() as server:
+            minimal_pipe_mit5k.contrast_sweep_pipe(_TEST_DNG, *self.params,
+                                                   contrasts, outputs,
+                                                   variant_kwargs,
+                                                   server=server,
+                                                   tap_dir=self.tap_dir,
+                                                   **tap_kwargs)
+        for output in outputs:
+            self.assertTrue(os.path.exists(output), output)
+
+    def test_every_variant_writes_every_tap(self):
+        self.render_contrast_sweep()
+        first = _taps(self.tap_dir, "0_")
+        # The upstream stages, not just the swept one.
+        self.assertIn("temperature_bayer_in.tmp", first)
+        self.assertIn("colorbalancergb_in.tmp", first)
+        self.assertEqual(_taps(self.tap_dir, "1_"), first)
+
+    def test_swept_module_taps_only(self):
+        self.render_contrast_sweep(taps=["colorbalancergb"])
+        expected = ["colorbalancergb_in.tmp", "colorbalancergb_out.tmp"]
+        self.assertEqual(_taps(self.tap_dir, "0_"), expected)
+        self.assertEqual(_taps(self.tap_dir, "1_"), expected)
+
+
+if __name__ == "__main__":
+    unittest.main()
@@ -0,0 +1,72 @@
+# Tap selection: darktable_pipe.tap_selected() and tap_env() against the
+# DT_TAP_SELECT rules of dump_tmp_select.h, and, with the dump-tmp-test
+# helper, against the taps the C side actually writes.
+#
+#   python -m unittest test_tap_selection
+import glob
+import os
+import unittest
+
+import darktable_pipe
+from test_dump_tmp import DumpTmpTestCase
+
+_TAPS = [
+    "temperature_bayer_in", "temperature_bayer_out", "colorin_in",
+    "colorin_out", "sharpen_in", "sharpen_out", "sharpen_out_0",
+    "sharpen_out_12", "colorbalancergb_in", "colorbalancergb_out",
+    "colorout_out"
+]
+
+# (patterns, selected taps); None is DT_TAP_SELECT unset.
+_CASES = [
+    (None, _TAPS),
+    ([], []),
+    (["none"], []),
+    (["colorin"], ["colorin_in", "colorin_out"]),
+    (["sharpen_out"], ["sharpen_out", "sharpen_out_0", "sharpen_out_12"]),
+    (["sharpen_out_1"], []),
+    (["sharpen_out_1*"], ["sharpen_out_12"]),
+    (["*_in"], ["temperature_bayer_in", "colorin_in", "sharpen_in",
+                "colorbalancergb_in"]),
+    (["*bayer*"], ["temperature_bayer_in", "temperature_bayer_out"]),
+    (["color?n_out", "colorout"], ["colorin_out", "colorout_out"]),
+    (["none", "", "colorout_out"], ["colorout_out"]),
+    (["colorbalance"], []),
+]
+
+
+class TapSelectedTest(unittest.TestCase):
+
+    def test_cases(self):
+        for patterns, expected in _CASES:
+            with self.subTest(patterns=patterns):
+                self.assertEqual(
+                    [t for t in _TAPS
+                     if darktable_pipe.tap_selected(t, patterns)], expected)
+
+    def test_tap_env(self):
+        self.assertEqual(
+            darktable_pipe.tap_env(taps=["colorin", "*_in"])["DT_TAP_SELECT"],
+            "colorin,*_in")
+        # An empty list must not mean "unset", which selects every tap.
+        self.assertEqual(darktable_pipe.tap_env(taps=[])["DT_TAP_SELECT"],
+                         "none")
+
+
+class WrittenTapsTest(DumpTmpTestCase):
+
+    def test_cases(self):
+        for k, (patterns, expected) in enumerate(_CASES):
+            with self.subTest(patterns=patterns):
+                env = {"DT_TAP_PREFIX": f"{k}_"}
+                if patterns is not None:
+                    env["DT_TAP_SELECT"] = ",".join(patterns)
+                self.write(_TAPS, width=4, height=2, **env)
+                written = sorted(
+                    os.path.basename(p)[len(f"{k}_"):-len(".tmp")]
+                    for p in glob.glob(self.path(f"{k}_*.tmp")))
+                self.assertEqual(written, sorted(expected))
+
+
+if __name__ == "__main__":
+    unittest.main()
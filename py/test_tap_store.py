@@ -0,0 +1,119 @@
+# The content-addressed tap store: tap_store.py's manifests on a store built
+# here, and, with the dump-tmp-test helper, the store dump_tmp() writes.
+#
+#   python -m unittest test_tap_store
+import glob
+import os
+import shutil
+import tempfile
+import unittest
+
+import numpy as np
+
+import loadTMP
+import tap_store
+from test_dump_tmp import DumpTmpTestCase, ramp
+from test_loadTMP import write_tmp
+
+
+class ManifestTest(unittest.TestCase):
+
+    def setUp(self):
+        self.dir = tempfile.mkdtemp(prefix="tap_store_test_")
+        self.addCleanup(shutil.rmtree, self.dir)
+        self.store = os.path.join(self.dir, "store")
+        self.tap_dir = os.path.join(self.dir, "taps")
+        os.makedirs(os.path.join(self.store, "ab"))
+        os.makedirs(self.tap_dir)
+
+    def add_object(self, name, link, image):
+        path = os.path.join(self.store, "ab", name)
+        write_tmp(path, image)
+        os.symlink(path, os.path.join(self.tap_dir, link))
+        return path
+
+    def test_collect(self):
+        image = ramp(8, 4, 3)
+        a = self.add_object("ab01.tmp", "0_sharpen_in.tmp", image)
+        b = self.add_object("ab02.tmp", "0_sharpen_out.tmp", image)
+        self.add_object("ab03.tmp", "1_sharpen_out.tmp", image)
+        # Not a store link.
+        write_tmp(os.path.join(self.tap_dir, "0_colorout_out.tmp"), image)
+
+        self.assertEqual(tap_store.collect(self.tap_dir, "0_"),
+                         {"sharpen_in": a, "sharpen_out": b})
+        self.assertEqual(sorted(os.listdir(self.tap_dir)),
+                         ["0_colorout_out.tmp", "1_sharpen_out.tmp"])
+
+    def test_manifest_round_trip(self):
+        taps = {
+            "sharpen_in": self.add_object("ab01.tmp", "sharpen_in.tmp",
+                                          ramp(8, 4, 3)),
+            "sharpen_out": os.path.join(self.store, "ab", "ab02.tif"),
+        }
+        manifest = os.path.join(self.dir, "render_taps.json")
+        # A relative store is recorded as an absolute path.
+        cwd = os.getcwd()
+        os.chdir(self.dir)
+        self.addCleanup(os.chdir, cwd)
+        tap_store.write_manifest(manifest, "store", taps)
+        self.assertEqual(tap_store.read_manifest(manifest), taps)
+
+    def test_to_tiff(self):
+        try:
+            import tifffile
+        except ImportError:
+            self.skipTest("needs tifffile")
+        image = ramp(8, 4, 4)
+        path = self.add_object("ab01.tmp", "sharpen_in.tmp", image)
+        tiff = tap_store.to_tiff(self.store, path)
+        self.assertEqual(tiff, os.path.join(self.store, "ab", "ab01.tif"))
+        np.testing.assert_array_equal(tifffile.imread(tiff), image[..., :3])
+        # Converted once, then reused; the TMP object is kept.
+        mtime = os.stat(tiff).st_mtime_ns
+        self.assertEqual(tap_store.to_tiff(self.store, path), tiff)
+        self.assertEqual(os.stat(tiff).st_mtime_ns, mtime)
+        self.assertTrue(os.path.exists(path))
+        self.assertEqual(tap_store.to_tiff(self.store, tiff), tiff)
+
+
+class StoreTest(DumpTmpTestCase):
+
+    def objects(self, store):
+        return sorted(glob.glob(os.path.join(store, "*", "*.tmp")))
+
+    def test_identical_taps_are_stored_once(self):
+        store = os.path.join(self.tap_dir, "store")
+        self.write(("a_in", "a_out"), DT_TAP_STORE=store, DT_TAP_PREFIX="0_")
+        self.write(("a_out",), DT_TAP_STORE=store, DT_TAP_PREFIX="1_")
+        objects = self.objects(store)
+        self.assertEqual(len(objects), 1)
+
+        taps = tap_store.collect(self.tap_dir, "0_")
+        self.assertEqual(taps, {"a_in": objects[0], "a_out": objects[0]})
+        np.testing.assert_array_equal(loadTMP.loadTMP(objects[0])[0], ramp())
+
+    def test_options_change_the_object(self):
+        store = os.path.join(self.tap_dir, "store")
+        self.write(DT_TAP_STORE=store)
+        self.write(DT_TAP_STORE=store, DT_TMP_ENCODING="float16")
+        self.write(DT_TAP_STORE=store, DT_TAP_DOWNSAMPLE="2")
+        self.assertEqual(len(self.objects(store)), 3)
+
+    def test_relative_store(self):
+        # DT_TAP_STORE is relative to the current directory, not to the tap
+        # directory the links are in.
+        work = os.path.join(self.tap_dir, "work")
+        os.makedirs(work)
+        self.write(DT_TAP_STORE="store", cwd=work)
+        link = os.readlink(self.path("test_out.tmp"))
+        self.assertTrue(os.path.isabs(link))
+        self.assertEqual(
+            os.path.realpath(self.path("test_out.tmp")),
+            os.path.realpath(self.objects(os.path.join(work, "store"))[0]))
+        np.testing.assert_array_equal(
+            loadTMP.loadTMP(self.path("test_out.tmp"))[0], ramp())
+
+
+if __name__ == "__main__":
+    unittest.main()
@@ -1,14 +1,18 @@
-from loadTMP import loadTMP
+from loadTMP import mmapTMP
+import numpy as np
 import tifffile
 
 
 def tmp2tiff(input_file, output_file):
-    im = loadTMP(input_file)
-    print(f"{input_file} has shape: {im.shape}")
-    output_channels = im.shape[-1]
+    # Lazy view: only frame 0 and the kept channels are read from disk.
+    view = mmapTMP(input_file)
+    print(f"{input_file} has shape: {view.shape}")
+    output_channels = view.shape[-1]
     output_channels = min(output_channels, 3)
     print(f"clipping to {output_channels} channel(s)")
-    im = im[0, :, :, :output_channels]
+    # Always float32, like dump_tmp_tiff(): float16 taps are widened and
+    # normalized uint16 taps are already decoded to float32 by the view.
+    im = view[0, :, :, :output_channels].astype(np.float32, copy=False)
     print(f'Writing: {output_file}')
     tifffile.imwrite(output_file, im)
     print("Done.")